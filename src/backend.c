@@ -0,0 +1,33 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <stdlib.h>
+
+#include "backend.h"
+#include "log.h"
+#include "mounts.h"
+
+const cgroup_backend_t *get_backend(void)
+{
+    static const cgroup_backend_t *backend = NULL;
+
+    if (backend != NULL)
+        return backend;
+
+    const cgroup_mounts_t *const mounts = get_mounts();
+
+    backend = ((mounts->version == 2) ? &backend_v2 : &backend_v1);
+
+    LOG_D("Using cgroup v%u in '%s'.", backend->version, mounts->paths[0]);
+
+    return backend;
+}
+
+const io_device_limits_t *find_io_device(const cgroup_limits_t *const limits, const unsigned int major, const unsigned int minor)
+{
+    for (unsigned int i = 0; i < limits->io_max_count; i++)
+        if (limits->io_max[i].major == major && limits->io_max[i].minor == minor)
+            return &limits->io_max[i];
+
+    return NULL;
+}
@@ -0,0 +1,93 @@
+#ifndef SRC_BACKEND_H_
+#define SRC_BACKEND_H_
+
+#include "cgroup.h"
+#include "group.h"
+
+// минимальная квота CPU, допускаемая ядром, микросекунд
+#define MIN_CPU_QUOTA_US (1000u)
+
+// максимальный вес в blkio.bfq.weight и io.bfq.weight: у BFQ шкала меньше, чем у io.weight
+#define MAX_BFQ_WEIGHT (1000u)
+
+// размер буфера для чтения файлов статистики: memory.stat на v2 занимает несколько килобайт
+#define STAT_BUF_SIZE (8192u)
+
+/*
+ * Потребление ресурсов cgroup. Поля, файлов которых нет (контроллер не смонтирован
+ * или ядро старое), остаются нулевыми.
+ */
+typedef struct
+{
+    uint64_t cpu_usage_ns; // суммарное время CPU, наносекунд
+    uint64_t nr_periods; // количество прошедших периодов квоты CPU
+    uint64_t nr_throttled; // количество периодов, в которых cgroup упиралась в квоту
+    uint64_t throttled_ns; // суммарное время простоя из-за квоты, наносекунд
+    uint64_t mem_usage; // текущее потребление памяти, байт
+    uint64_t mem_peak; // максимальное потребление памяти, байт
+    uint64_t mem_anon; // анонимная память, байт
+    uint64_t mem_file; // страничный кэш, байт
+    uint64_t mem_swap; // память в свопе, байт
+    uint64_t pgmajfault; // количество major page fault'ов
+} group_usage_t;
+
+/*
+ * Реализация работы с конкретной версией cgroup: v1 (отдельные контроллеры,
+ * cpu.shares, memory.limit_in_bytes, freezer.state, tasks) или v2 (unified-иерархия,
+ * cpu.weight, memory.max, cgroup.freeze, cgroup.procs).
+ */
+typedef struct
+{
+    unsigned int version; // версия cgroup: 1 или 2
+    const char *procs_file; // файл, в который пишется pid для помещения процесса в cgroup
+    const char *freezer_file; // файл управления заморозкой cgroup
+    const char *events_file; // файл с уведомлениями о состоянии cgroup или NULL если его нет
+    const char *stat_files[GROUP_FILES_COUNT]; // файлы статистики по group_file_t или NULL если их нет
+
+    /*
+     * \brief Инициализирует только что созданную cgroup: включает контроллеры и задаёт cpuset.
+     * \param const group_dir_t *const root: Корневой каталог.
+     * \param const group_dir_t *const dir: Каталог cgroup.
+     * \param const cgroup_limits_t *const limits: Ограничения.
+     */
+    void (*init_group)(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits);
+
+    /*
+     * \brief Устанавливает заданные ограничения.
+     * \param const group_dir_t *const root: Корневой каталог.
+     * \param const group_dir_t *const dir: Каталог cgroup.
+     * \param const cgroup_limits_t *const limits: Ограничения.
+     */
+    void (*apply_limits)(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits);
+
+    /*
+     * \brief Читает потребление ресурсов cgroup, по одному pread(2) на файл.
+     * \param group_dir_t *dir: Каталог cgroup, файлы статистики остаются в нём открытыми.
+     * \param group_usage_t *usage: Потребление ресурсов.
+     * \return 1 в случае ошибок (например, cgroup удалили); 0 если всё прочитано.
+     */
+    int (*get_usage)(group_dir_t *dir, group_usage_t *usage);
+} cgroup_backend_t;
+
+extern const cgroup_backend_t backend_v1;
+extern const cgroup_backend_t backend_v2;
+
+/*
+ * \fn const cgroup_backend_t *get_backend(void)
+ * \brief Определяет версию смонтированных cgroup и возвращает её реализацию.
+ * \return Реализация cgroup. Версия определяется один раз, при первом вызове.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+const cgroup_backend_t *get_backend(void);
+
+/*
+ * \fn const io_device_limits_t *find_io_device(const cgroup_limits_t *const limits, const unsigned int major, const unsigned int minor)
+ * \brief Ищет ограничения ввода-вывода устройства.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ * \param const unsigned int major: Старший номер устройства.
+ * \param const unsigned int minor: Младший номер устройства.
+ * \return Ограничения устройства; NULL - если для устройства ничего не задано.
+ */
+const io_device_limits_t *find_io_device(const cgroup_limits_t *const limits, const unsigned int major, const unsigned int minor);
+
+#endif /* SRC_BACKEND_H_ */
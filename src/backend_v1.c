@@ -0,0 +1,379 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "conf.h"
+#include "log.h"
+#include "numa.h"
+#include "utils.h"
+
+/*
+ * \fn void init_group_v1(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits)
+ * \brief Инициализирует созданную cgroup: заполняет cpuset.cpus и cpuset.mems заданными
+ *        CPU и узлом NUMA, а то, что не задано, копирует из корневого каталога.
+ * \param const group_dir_t *const root: Корневой каталог.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ */
+static void init_group_v1(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits)
+{
+    cpuset_t cpuset;
+
+    get_cpuset(root, dir, limits, &cpuset);
+
+    // WARN: memory_migrate должен быть включен до смены cpuset.mems и до переноса
+    // процессов в cgroup, иначе уже выделенная память останется на старых узлах.
+
+    if ((limits->memory_migrate || dir->reused) && update_num(limits->memory_migrate, dir, "cpuset.memory_migrate") != 0) {
+        LOG_C("Unable to set cpuset.memory_migrate for group '%s'.", dir->name);
+        abort();
+    }
+
+    if (*cpuset.cpus == '\0')
+        copy_raw_content(root, dir, "cpuset.cpus");
+    else if (update_str(cpuset.cpus, dir, "cpuset.cpus") != 0) {
+        LOG_C("Unable to set CPUs for group '%s'.", dir->name);
+        abort();
+    }
+
+    if (*cpuset.mems == '\0')
+        copy_raw_content(root, dir, "cpuset.mems");
+    else if (update_str(cpuset.mems, dir, "cpuset.mems") != 0) {
+        LOG_C("Unable to set NUMA nodes for group '%s'.", dir->name);
+        abort();
+    }
+}
+
+// вес ввода-вывода по-умолчанию в blkio.weight
+#define DEFAULT_BLKIO_WEIGHT (500u)
+
+// допустимые значения blkio.weight
+#define MIN_BLKIO_WEIGHT (10u)
+#define MAX_BLKIO_WEIGHT (1000u)
+
+// clang-format off
+static const char *const throttle_files[IO_LIMITS_COUNT] = {
+    [IO_LIMIT_RBPS] = "blkio.throttle.read_bps_device",
+    [IO_LIMIT_WBPS] = "blkio.throttle.write_bps_device",
+    [IO_LIMIT_RIOPS] = "blkio.throttle.read_iops_device",
+    [IO_LIMIT_WIOPS] = "blkio.throttle.write_iops_device"
+};
+// clang-format on
+
+/*
+ * \fn void write_throttle(const group_dir_t *const dir, const char *const file_name, const unsigned int major, const unsigned int minor, const uint64_t value)
+ * \brief Записывает ограничение ввода-вывода устройства в файл blkio.throttle.*.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \param const unsigned int major: Старший номер устройства.
+ * \param const unsigned int minor: Младший номер устройства.
+ * \param const uint64_t value: Ограничение; 0 - снять ограничение.
+ */
+static void write_throttle(const group_dir_t *const dir, const char *const file_name, const unsigned int major, const unsigned int minor,
+    const uint64_t value)
+{
+    char buf[3 * MAX_UINT64_STR_SIZE];
+
+    if (snprintf(buf, sizeof(buf), "%u:%u %" PRIu64 "\n", major, minor, value) < 0) {
+        LOG_C("Unable to format I/O limit, error '%m'.");
+        abort();
+    }
+
+    if (write_str(buf, dir, file_name) != 0) {
+        LOG_C("Unable to set I/O limit %" PRIu64 " of device %u:%u in '%s'.", value, major, minor, file_name);
+        abort();
+    }
+}
+
+/*
+ * \fn void apply_io_limits_v1(const group_dir_t *const dir, const cgroup_limits_t *const limits)
+ * \brief Устанавливает вес и ограничения ввода-вывода через контроллер blkio.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ */
+static void apply_io_limits_v1(const group_dir_t *const dir, const cgroup_limits_t *const limits)
+{
+    // Если ничего не задано и cgroup новая, то и сбрасывать нечего: blkio может быть даже не смонтирован.
+
+    if (limits->io_weight == 0 && limits->io_max_count == 0 && !dir->reused)
+        return;
+
+    // Файл веса есть только у планировщиков с пропорциональным распределением: у CFQ
+    // blkio.weight со своей шкалой (пересчитываем так же, как systemd), у BFQ blkio.bfq.weight
+    // со шкалой io.weight, но не выше MAX_BFQ_WEIGHT.
+
+    const bool is_bfq = !group_has_file(dir, "blkio.weight");
+    const char *const weight_file = ((is_bfq) ? "blkio.bfq.weight" : "blkio.weight");
+
+    if (limits->io_weight != 0 || group_has_file(dir, weight_file)) {
+        uint64_t weight = ((limits->io_weight != 0) ? limits->io_weight : DEFAULT_IO_WEIGHT);
+
+        if (is_bfq && weight > MAX_BFQ_WEIGHT)
+            weight = MAX_BFQ_WEIGHT;
+
+        if (!is_bfq) {
+            weight = (weight * DEFAULT_BLKIO_WEIGHT) / DEFAULT_IO_WEIGHT;
+
+            if (weight < MIN_BLKIO_WEIGHT)
+                weight = MIN_BLKIO_WEIGHT;
+            else if (weight > MAX_BLKIO_WEIGHT)
+                weight = MAX_BLKIO_WEIGHT;
+        }
+
+        if (update_num(weight, dir, weight_file) != 0)
+            LOG_E("Unable to set I/O weight %" PRIu64 ", ignoring.", weight);
+    }
+
+    // В файлах blkio.throttle.* по строке на устройство: "8:0 1048576". Запись с нулём
+    // снимает ограничение, поэтому пишем только то, что отличается от текущего.
+
+    for (io_limit_t limit = 0; limit < IO_LIMITS_COUNT; limit++) {
+        char current[1024] = "";
+        bool up_to_date[MAX_IO_DEVICES] = { false };
+        unsigned int major;
+        unsigned int minor;
+        uint64_t value;
+        int len;
+
+        if (limits->io_max_count == 0 && !group_has_file(dir, throttle_files[limit]))
+            continue; // blkio не смонтирован вместе с остальными контроллерами
+
+        if (dir->reused && read_str(current, sizeof(current), dir, throttle_files[limit]) == -1) {
+            LOG_C("Unable to read I/O limits of group '%s'.", dir->name);
+            abort();
+        }
+
+        // Снимаем ограничения, оставшиеся от прошлого запуска с другими опциями.
+
+        for (const char *line = current; sscanf(line, "%u:%u %" SCNu64 "%n", &major, &minor, &value, &len) == 3; line += len) {
+            const io_device_limits_t *const device = find_io_device(limits, major, minor);
+
+            if (device == NULL || device->max[limit] == 0)
+                write_throttle(dir, throttle_files[limit], major, minor, 0);
+            else if (device->max[limit] == value)
+                up_to_date[device - limits->io_max] = true;
+        }
+
+        for (unsigned int i = 0; i < limits->io_max_count; i++)
+            if (limits->io_max[i].max[limit] != 0 && !up_to_date[i])
+                write_throttle(dir, throttle_files[limit], limits->io_max[i].major, limits->io_max[i].minor, limits->io_max[i].max[limit]);
+    }
+}
+
+/*
+ * \fn void apply_limits_v1(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits)
+ * \brief Устанавливает заданные ограничения.
+ * \param const group_dir_t *const root: Корневой каталог.
+ * \param const group_dir_t *const dir: Каталог /cgroup/$group_name.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ */
+static void apply_limits_v1(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits)
+{
+    struct sysinfo info;
+
+    if (sysinfo(&info) == -1) {
+        LOG_C("Unable to get system information, error '%m'.");
+        abort();
+    }
+
+    LOG_D("System information: RAM %" PRIu64 ", SWAP %" PRIu64 ".", info.totalram, info.totalswap);
+
+    const char *const cpu_limit_name = "cpu.shares";
+    const char *const mem_limit_name = "memory.limit_in_bytes";
+    const char *const swap_limit_name = "memory.memsw.limit_in_bytes";
+
+    const uint64_t mem_limit = page_align((info.totalram * limits->mem_usage) / 100);
+
+    const uint64_t swap_limit = page_align((info.totalswap * limits->mem_usage) / 100) + mem_limit;
+
+    uint64_t cpu_limit;
+
+    if (read_num(&cpu_limit, root, cpu_limit_name)) {
+        LOG_C("Unable to read CPU limit current value.");
+        abort();
+    }
+
+    cpu_limit = (cpu_limit * limits->cpu_usage) / 100;
+
+    LOG_D("Setting limits: CPU=%" PRIu64 ", RAM %" PRIu64 ", SWAP %" PRIu64 ".", cpu_limit, mem_limit, swap_limit);
+
+    assert(cpu_limit != 0);
+    assert(mem_limit != 0);
+    assert(swap_limit != 0);
+
+    // WARN: Лимит со свопом должен быть строго >= лимиту оперативки.
+    // Равен он может быть если свопа нет вообще, не считаем это ошибкой!
+    assert(swap_limit >= mem_limit);
+
+    if (update_num(cpu_limit, dir, cpu_limit_name) != 0) {
+        LOG_C("Unable to set CPU limit value %" PRIu64 ".", cpu_limit);
+        abort();
+    }
+
+    // Жёсткое ограничение: не более cpu_quota/1000 ядер за каждый период, даже если
+    // остальные ядра простаивают. Период пишем первым, квота проверяется относительно него.
+
+    if (limits->cpu_quota != 0) {
+        uint64_t quota_us = ((uint64_t) limits->cpu_quota * limits->cpu_period_us) / 1000;
+
+        if (quota_us < MIN_CPU_QUOTA_US)
+            quota_us = MIN_CPU_QUOTA_US;
+
+        LOG_D("Setting CPU quota %" PRIu64 " us per %u us.", quota_us, limits->cpu_period_us);
+
+        if (update_num(limits->cpu_period_us, dir, "cpu.cfs_period_us") != 0) {
+            LOG_C("Unable to set CPU period %u.", limits->cpu_period_us);
+            abort();
+        }
+
+        if (update_num(quota_us, dir, "cpu.cfs_quota_us") != 0) {
+            LOG_C("Unable to set CPU quota %" PRIu64 ".", quota_us);
+            abort();
+        }
+    } else if (dir->reused && update_str("-1\n", dir, "cpu.cfs_quota_us") != 0) {
+        // Квота могла остаться от прошлого запуска с другими опциями.
+        LOG_C("Unable to reset CPU quota.");
+        abort();
+    }
+
+    /*
+     * WARN: Ядро требует memory.limit_in_bytes <= memory.memsw.limit_in_bytes после каждой записи.
+     * В новой cgroup оба лимита бесконечны, а в переиспользуемой при повышении лимитов
+     * первым нужно поднять лимит со свопом, иначе запись лимита оперативки вернёт EINVAL.
+     */
+
+    uint64_t current_limit = 0;
+
+    if (dir->reused && read_num(&current_limit, dir, mem_limit_name) != 0) {
+        LOG_C("Unable to read memory limit current value.");
+        abort();
+    }
+
+    const bool raising = (dir->reused && mem_limit > current_limit);
+
+    if (raising && update_num(swap_limit, dir, swap_limit_name) != 0) {
+        LOG_C("Unable to set swap limit %" PRIu64 ".", swap_limit);
+        abort();
+    }
+
+    if (update_num(mem_limit, dir, mem_limit_name) != 0) {
+        LOG_C("Unable to set memory limit %" PRIu64 ".", mem_limit);
+        abort();
+    }
+
+    if (!raising && update_num(swap_limit, dir, swap_limit_name) != 0) {
+        LOG_C("Unable to set swap limit %" PRIu64 ".", swap_limit);
+        abort();
+    }
+
+    /*
+     * Мягкое ограничение: пока памяти в системе хватает, оно ни на что не влияет, а при
+     * нехватке ядро в первую очередь отбирает страницы у cgroup, превысивших его,
+     * вместо того чтобы дожидаться жёсткого ограничения и OOM.
+     */
+
+    if (limits->mem_high != 0) {
+        uint64_t soft_limit = page_align(limits->mem_high);
+
+        if (soft_limit > mem_limit) {
+            LOG_E("Soft memory limit %" PRIu64 " is above the hard one, using %" PRIu64 ".", soft_limit, mem_limit);
+            soft_limit = mem_limit;
+        }
+
+        if (update_num(soft_limit, dir, "memory.soft_limit_in_bytes") != 0) {
+            LOG_C("Unable to set soft memory limit %" PRIu64 ".", soft_limit);
+            abort();
+        }
+    } else if (dir->reused) {
+        // Записанное -1 читается обратно как максимум, округлённый до страниц, поэтому
+        // сбрасываем ограничение, только если оно действительно осталось от прошлого запуска.
+        uint64_t soft_limit = 0;
+
+        if (read_num(&soft_limit, dir, "memory.soft_limit_in_bytes") != 0) {
+            LOG_C("Unable to read soft memory limit current value.");
+            abort();
+        }
+
+        if (soft_limit < page_align(INT64_MAX) && update_str("-1\n", dir, "memory.soft_limit_in_bytes") != 0) {
+            LOG_C("Unable to reset soft memory limit.");
+            abort();
+        }
+    }
+
+    apply_io_limits_v1(dir, limits);
+}
+
+/*
+ * \fn int get_usage_v1(group_dir_t *dir, group_usage_t *usage)
+ * \brief Читает потребление ресурсов cgroup из cpuacct, cpu и memory.
+ * \param group_dir_t *dir: Каталог cgroup.
+ * \param group_usage_t *usage: Потребление ресурсов.
+ * \return 1 в случае ошибок; 0 если всё прочитано.
+ */
+static int get_usage_v1(group_dir_t *dir, group_usage_t *usage)
+{
+    char buf[STAT_BUF_SIZE];
+
+    memset(usage, 0, sizeof(*usage));
+
+    if (read_group_file(buf, sizeof(buf), dir, GROUP_FILE_CPU_USAGE) == -1)
+        return 1;
+
+    usage->cpu_usage_ns = str2uint(buf);
+
+    if (read_group_file(buf, sizeof(buf), dir, GROUP_FILE_CPU_STAT) == -1)
+        return 1;
+
+    usage->nr_periods = get_key_value(buf, "nr_periods");
+    usage->nr_throttled = get_key_value(buf, "nr_throttled");
+    usage->throttled_ns = get_key_value(buf, "throttled_time");
+
+    if (read_group_file(buf, sizeof(buf), dir, GROUP_FILE_MEM_USAGE) == -1)
+        return 1;
+
+    usage->mem_usage = str2uint(buf);
+
+    if (read_group_file(buf, sizeof(buf), dir, GROUP_FILE_MEM_PEAK) == -1)
+        return 1;
+
+    usage->mem_peak = str2uint(buf);
+
+    if (read_group_file(buf, sizeof(buf), dir, GROUP_FILE_MEM_STAT) == -1)
+        return 1;
+
+    // total_* учитывают и вложенные cgroup, как и memory.usage_in_bytes.
+    usage->mem_anon = get_key_value(buf, "total_rss");
+    usage->mem_file = get_key_value(buf, "total_cache");
+    usage->pgmajfault = get_key_value(buf, "total_pgmajfault");
+    usage->mem_swap = get_key_value(buf, "total_swap"); // есть только при включенном учёте свопа
+
+    return 0;
+}
+
+// clang-format off
+const cgroup_backend_t backend_v1 = {
+    .version = 1,
+    .procs_file = "tasks",
+    .freezer_file = "freezer.state",
+    .events_file = NULL,
+    .stat_files = {
+        [GROUP_FILE_CPU_USAGE] = "cpuacct.usage",
+        [GROUP_FILE_CPU_STAT] = "cpu.stat",
+        [GROUP_FILE_MEM_USAGE] = "memory.usage_in_bytes",
+        [GROUP_FILE_MEM_PEAK] = "memory.max_usage_in_bytes",
+        [GROUP_FILE_MEM_STAT] = "memory.stat"
+    },
+    .init_group = init_group_v1,
+    .apply_limits = apply_limits_v1,
+    .get_usage = get_usage_v1
+};
+// clang-format on
@@ -0,0 +1,416 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "conf.h"
+#include "log.h"
+#include "numa.h"
+#include "utils.h"
+
+// вес cgroup по-умолчанию в cpu.weight, соответствует 100% CPU
+#define DEFAULT_CPU_WEIGHT (100u)
+
+/*
+ * \fn bool is_controller_enabled(const char *const enabled, const char *const name)
+ * \brief Проверяет, есть ли контроллер в списке из cgroup.subtree_control.
+ * \param const char *const enabled: Список контроллеров через пробел.
+ * \param const char *const name: Название контроллера.
+ * \return true - если контроллер включен; false - если нет.
+ */
+static bool is_controller_enabled(const char *const enabled, const char *const name)
+{
+    const size_t len = strlen(name);
+
+    for (const char *p = enabled; (p = strstr(p, name)) != NULL; p += len)
+        // Отсекаем частичные совпадения, например "cpu" в "cpuset".
+        if ((p == enabled || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\n' || p[len] == '\0'))
+            return true;
+
+    return false;
+}
+
+/*
+ * \fn void enable_controller(const group_dir_t *const root, const char *const enabled, const char *const controller)
+ * \brief Включает контроллер для дочерних cgroup корневого каталога, если он ещё не включен.
+ * \param const group_dir_t *const root: Корневой каталог.
+ * \param const char *const enabled: Содержимое cgroup.subtree_control корневого каталога.
+ * \param const char *const controller: Контроллер с префиксом '+'.
+ */
+static void enable_controller(const group_dir_t *const root, const char *const enabled, const char *const controller)
+{
+    if (is_controller_enabled(enabled, controller + 1)) // +1 на '+'
+        return;
+
+    if (write_str(controller, root, "cgroup.subtree_control") != 0) {
+        LOG_C("Unable to enable controller '%s'.", controller);
+        abort();
+    }
+}
+
+/*
+ * \fn void init_group_v2(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits)
+ * \brief Включает контроллеры cpu и memory (и cpuset, io и pids, если они нужны) для дочерних cgroup
+ *        корневого каталога и задаёт cpuset.
+ * \param const group_dir_t *const root: Корневой каталог.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ */
+static void init_group_v2(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits)
+{
+    char enabled[256];
+    cpuset_t cpuset;
+
+    // WARN: На unified-иерархии файлы контроллеров появляются в cgroup только если
+    // контроллер включен в cgroup.subtree_control родителя. Запись идемпотентна,
+    // но уже включенные контроллеры не трогаем вовсе.
+
+    if (read_str(enabled, sizeof(enabled), root, "cgroup.subtree_control") == -1) {
+        LOG_C("Unable to read enabled controllers for group '%s'.", dir->name);
+        abort();
+    }
+
+    enable_controller(root, enabled, "+cpu");
+    enable_controller(root, enabled, "+memory");
+
+    if (limits->io_weight != 0 || limits->io_max_count != 0)
+        enable_controller(root, enabled, "+io");
+
+    if (limits->max_tasks != 0)
+        enable_controller(root, enabled, "+pids");
+
+    get_cpuset(root, dir, limits, &cpuset);
+
+    if (*cpuset.cpus == '\0' && *cpuset.mems == '\0') {
+        // Пустой cpuset в v2 означает "как у родителя". Сбрасываем привязку,
+        // оставшуюся в переиспользуемой cgroup от прошлого запуска.
+
+        if (dir->reused && group_has_file(dir, "cpuset.cpus")
+            && (update_str("\n", dir, "cpuset.cpus") != 0 || update_str("\n", dir, "cpuset.mems") != 0)) {
+            LOG_C("Unable to reset cpuset of group '%s'.", dir->name);
+            abort();
+        }
+
+        return;
+    }
+
+    enable_controller(root, enabled, "+cpuset");
+
+    // В v2 память переносится при смене cpuset.mems всегда, отдельного memory_migrate нет.
+
+    if (limits->memory_migrate)
+        LOG_D("Option memory_migrate is always on for cgroup v2.");
+
+    if (update_str(((*cpuset.cpus == '\0') ? "\n" : cpuset.cpus), dir, "cpuset.cpus") != 0) {
+        LOG_C("Unable to set CPUs for group '%s'.", dir->name);
+        abort();
+    }
+
+    if (update_str(((*cpuset.mems == '\0') ? "\n" : cpuset.mems), dir, "cpuset.mems") != 0) {
+        LOG_C("Unable to set NUMA nodes for group '%s'.", dir->name);
+        abort();
+    }
+}
+
+/*
+ * \fn void format_io_max(char *buf, const size_t size, const unsigned int major, const unsigned int minor,
+ *                         const io_device_limits_t *const device)
+ * \brief Формирует строку io.max для устройства в том виде, в каком её выводит ядро.
+ * \param char *buf: Буфер для строки.
+ * \param const size_t size: Размер буфера.
+ * \param const unsigned int major: Старший номер устройства.
+ * \param const unsigned int minor: Младший номер устройства.
+ * \param const io_device_limits_t *const device: Ограничения устройства; NULL - снять все ограничения.
+ */
+static void format_io_max(char *buf, const size_t size, const unsigned int major, const unsigned int minor,
+    const io_device_limits_t *const device)
+{
+    int len = snprintf(buf, size, "%u:%u", major, minor);
+
+    for (io_limit_t limit = 0; limit < IO_LIMITS_COUNT && len > 0 && (size_t) len < size; limit++) {
+        if (device == NULL || device->max[limit] == 0)
+            len += snprintf(buf + len, size - len, " %s=max", io_limit_names[limit]);
+        else
+            len += snprintf(buf + len, size - len, " %s=%" PRIu64, io_limit_names[limit], device->max[limit]);
+    }
+
+    if (len <= 0 || (size_t) len + 1 >= size) {
+        LOG_C("Unable to format I/O limits of device %u:%u.", major, minor);
+        abort();
+    }
+
+    buf[len++] = '\n';
+    buf[len] = '\0';
+}
+
+/*
+ * \fn void apply_io_limits_v2(const group_dir_t *const dir, const cgroup_limits_t *const limits)
+ * \brief Устанавливает вес и ограничения ввода-вывода через io.weight и io.max.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ */
+static void apply_io_limits_v2(const group_dir_t *const dir, const cgroup_limits_t *const limits)
+{
+    // Контроллер io включается только если что-то задано, без него файлов нет.
+
+    if (!group_has_file(dir, "io.max"))
+        return;
+
+    // io.weight есть только при включенном iocost, у BFQ свой файл с меньшей шкалой.
+
+    const bool is_bfq = !group_has_file(dir, "io.weight");
+    const char *const weight_file = ((is_bfq) ? "io.bfq.weight" : "io.weight");
+
+    if (limits->io_weight != 0 || (dir->reused && group_has_file(dir, weight_file))) {
+        char weight[MAX_UINT64_STR_SIZE];
+        unsigned int value = ((limits->io_weight != 0) ? limits->io_weight : DEFAULT_IO_WEIGHT);
+
+        if (is_bfq && value > MAX_BFQ_WEIGHT)
+            value = MAX_BFQ_WEIGHT;
+
+        snprintf(weight, sizeof(weight), "default %u\n", value);
+
+        if (update_str(weight, dir, weight_file) != 0)
+            LOG_E("Unable to set I/O weight %u, ignoring.", value);
+    }
+
+    if (limits->io_max_count == 0 && !dir->reused)
+        return;
+
+    // В io.max по строке на устройство: "8:0 rbps=max wbps=1048576 riops=max wiops=max".
+    // Устройства, для которых ничего не задано, ядро не выводит.
+
+    char current[1024] = "";
+    char line[2 * MAX_FILE_PATH];
+    bool up_to_date[MAX_IO_DEVICES] = { false };
+    unsigned int major;
+    unsigned int minor;
+
+    if (dir->reused && read_str(current, sizeof(current), dir, "io.max") == -1) {
+        LOG_C("Unable to read I/O limits of group '%s'.", dir->name);
+        abort();
+    }
+
+    for (char *cur = current, *eol; *cur != '\0'; cur = eol + 1) {
+        if ((eol = strchr(cur, '\n')) == NULL)
+            break;
+
+        if (sscanf(cur, "%u:%u", &major, &minor) != 2)
+            continue;
+
+        const io_device_limits_t *const device = find_io_device(limits, major, minor);
+
+        format_io_max(line, sizeof(line), major, minor, device);
+
+        // Ограничения, оставшиеся от прошлого запуска с другими опциями, снимаем.
+
+        if (strncmp(cur, line, eol - cur + 1) == 0) {
+            if (device != NULL)
+                up_to_date[device - limits->io_max] = true;
+
+        } else if (device == NULL && write_str(line, dir, "io.max") != 0) {
+            LOG_C("Unable to reset I/O limits of device %u:%u.", major, minor);
+            abort();
+        }
+    }
+
+    for (unsigned int i = 0; i < limits->io_max_count; i++) {
+        const io_device_limits_t *const device = &limits->io_max[i];
+
+        if (up_to_date[i])
+            continue;
+
+        format_io_max(line, sizeof(line), device->major, device->minor, device);
+
+        if (write_str(line, dir, "io.max") != 0) {
+            LOG_C("Unable to set I/O limits of device %u:%u.", device->major, device->minor);
+            abort();
+        }
+    }
+}
+
+/*
+ * \fn void apply_limits_v2(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits)
+ * \brief Устанавливает заданные ограничения.
+ * \param const group_dir_t *const root: Корневой каталог (не используется).
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ */
+static void apply_limits_v2(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits)
+{
+    (void) root; // веса в v2 абсолютные, от корня ничего не нужно
+
+    struct sysinfo info;
+
+    if (sysinfo(&info) == -1) {
+        LOG_C("Unable to get system information, error '%m'.");
+        abort();
+    }
+
+    LOG_D("System information: RAM %" PRIu64 ", SWAP %" PRIu64 ".", info.totalram, info.totalswap);
+
+    // WARN: В отличие от memory.memsw.limit_in_bytes в v1, memory.swap.max
+    // ограничивает только своп, без учёта оперативной памяти.
+
+    const uint64_t mem_limit = page_align((info.totalram * limits->mem_usage) / 100);
+
+    const uint64_t swap_limit = page_align((info.totalswap * limits->mem_usage) / 100);
+
+    // У корневой cgroup в v2 нет cpu.weight, поэтому считаем от веса по-умолчанию.
+
+    uint64_t cpu_limit = (DEFAULT_CPU_WEIGHT * limits->cpu_usage) / 100;
+
+    if (cpu_limit == 0)
+        cpu_limit = 1; // минимально допустимый вес
+
+    LOG_D("Setting limits: CPU=%" PRIu64 ", RAM %" PRIu64 ", SWAP %" PRIu64 ".", cpu_limit, mem_limit, swap_limit);
+
+    assert(mem_limit != 0);
+
+    if (update_num(cpu_limit, dir, "cpu.weight") != 0) {
+        LOG_C("Unable to set CPU limit value %" PRIu64 ".", cpu_limit);
+        abort();
+    }
+
+    // Жёсткое ограничение: не более cpu_quota/1000 ядер за каждый период.
+
+    if (limits->cpu_quota != 0) {
+        char cpu_max[2 * MAX_UINT64_STR_SIZE];
+
+        uint64_t quota_us = ((uint64_t) limits->cpu_quota * limits->cpu_period_us) / 1000;
+
+        if (quota_us < MIN_CPU_QUOTA_US)
+            quota_us = MIN_CPU_QUOTA_US;
+
+        if (snprintf(cpu_max, sizeof(cpu_max), "%" PRIu64 " %u\n", quota_us, limits->cpu_period_us) < 0) {
+            LOG_C("Unable to format CPU quota, error '%m'.");
+            abort();
+        }
+
+        if (update_str(cpu_max, dir, "cpu.max") != 0) {
+            LOG_C("Unable to set CPU quota %" PRIu64 " per %u us.", quota_us, limits->cpu_period_us);
+            abort();
+        }
+    } else if (dir->reused) {
+        char cpu_max[2 * MAX_UINT64_STR_SIZE];
+
+        // Квота могла остаться от прошлого запуска с другими опциями.
+
+        if (snprintf(cpu_max, sizeof(cpu_max), "max %u\n", CPU_PERIOD_US) < 0) {
+            LOG_C("Unable to format CPU quota, error '%m'.");
+            abort();
+        }
+
+        if (update_str(cpu_max, dir, "cpu.max") != 0) {
+            LOG_C("Unable to reset CPU quota.");
+            abort();
+        }
+    }
+
+    if (update_num(mem_limit, dir, "memory.max") != 0) {
+        LOG_C("Unable to set memory limit %" PRIu64 ".", mem_limit);
+        abort();
+    }
+
+    if (update_num(swap_limit, dir, "memory.swap.max") != 0) {
+        LOG_C("Unable to set swap limit %" PRIu64 ".", swap_limit);
+        abort();
+    }
+
+    // Выше memory.high ядро не убивает процессы, а притормаживает их выделения
+    // и принудительно отбирает память у cgroup, не дожидаясь OOM на memory.max.
+
+    if (limits->mem_high != 0) {
+        uint64_t high_limit = page_align(limits->mem_high);
+
+        if (high_limit > mem_limit) {
+            LOG_E("Soft memory limit %" PRIu64 " is above the hard one, using %" PRIu64 ".", high_limit, mem_limit);
+            high_limit = mem_limit;
+        }
+
+        if (update_num(high_limit, dir, "memory.high") != 0) {
+            LOG_C("Unable to set soft memory limit %" PRIu64 ".", high_limit);
+            abort();
+        }
+    } else if (dir->reused && update_str("max\n", dir, "memory.high") != 0) {
+        LOG_C("Unable to reset soft memory limit.");
+        abort();
+    }
+
+    apply_io_limits_v2(dir, limits);
+}
+
+/*
+ * \fn int get_usage_v2(group_dir_t *dir, group_usage_t *usage)
+ * \brief Читает потребление ресурсов cgroup из cpu.stat и файлов memory.
+ * \param group_dir_t *dir: Каталог cgroup.
+ * \param group_usage_t *usage: Потребление ресурсов.
+ * \return 1 в случае ошибок; 0 если всё прочитано.
+ */
+static int get_usage_v2(group_dir_t *dir, group_usage_t *usage)
+{
+    char buf[STAT_BUF_SIZE];
+
+    memset(usage, 0, sizeof(*usage));
+
+    // cpu.stat есть всегда, даже без контроллера cpu: тогда в нём только usage_usec и т.п.
+    if (read_group_file(buf, sizeof(buf), dir, GROUP_FILE_CPU_STAT) == -1)
+        return 1;
+
+    usage->cpu_usage_ns = get_key_value(buf, "usage_usec") * 1000u;
+    usage->nr_periods = get_key_value(buf, "nr_periods");
+    usage->nr_throttled = get_key_value(buf, "nr_throttled");
+    usage->throttled_ns = get_key_value(buf, "throttled_usec") * 1000u;
+
+    if (read_group_file(buf, sizeof(buf), dir, GROUP_FILE_MEM_USAGE) == -1)
+        return 1;
+
+    usage->mem_usage = str2uint(buf);
+
+    // memory.peak появился только в 5.19.
+    if (read_group_file(buf, sizeof(buf), dir, GROUP_FILE_MEM_PEAK) == -1)
+        return 1;
+
+    usage->mem_peak = str2uint(buf);
+
+    if (read_group_file(buf, sizeof(buf), dir, GROUP_FILE_MEM_STAT) == -1)
+        return 1;
+
+    usage->mem_anon = get_key_value(buf, "anon");
+    usage->mem_file = get_key_value(buf, "file");
+    usage->pgmajfault = get_key_value(buf, "pgmajfault");
+
+    if (read_group_file(buf, sizeof(buf), dir, GROUP_FILE_SWAP) == -1)
+        return 1;
+
+    usage->mem_swap = str2uint(buf);
+
+    return 0;
+}
+
+// clang-format off
+const cgroup_backend_t backend_v2 = {
+    .version = 2,
+    .procs_file = "cgroup.procs",
+    .freezer_file = "cgroup.freeze",
+    .events_file = "cgroup.events",
+    .stat_files = {
+        [GROUP_FILE_CPU_STAT] = "cpu.stat",
+        [GROUP_FILE_MEM_USAGE] = "memory.current",
+        [GROUP_FILE_MEM_PEAK] = "memory.peak",
+        [GROUP_FILE_MEM_STAT] = "memory.stat",
+        [GROUP_FILE_SWAP] = "memory.swap.current"
+    },
+    .init_group = init_group_v2,
+    .apply_limits = apply_limits_v2,
+    .get_usage = get_usage_v2
+};
+// clang-format on
@@ -1,197 +1,825 @@
 // This is a personal academic project. Dear PVS-Studio, please check it.
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 
-#include <assert.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/sysinfo.h>
+#include <sys/prctl.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "backend.h"
+#include "cgroup.h"
 #include "conf.h"
 #include "freezer.h"
+#include "group.h"
 #include "log.h"
 #include "tasks.h"
+#include "timings.h"
 #include "utils.h"
+#include "wait.h"
 
-// максимальное количество попыток прибить процессы, оставшиеся в cgroup.
-#define MAX_ATTEMPTS (10u)
+// таймаут ожидания удаления cgroup, миллисекунд
+static unsigned int destroy_timeout_ms = DESTROY_TIMEOUT_MS;
 
-// пауза между попытками, микросекунд
-#define ATTEMPTS_DELAY_US (200000u)
+// clang-format off
+const char *const io_limit_names[IO_LIMITS_COUNT] = {
+    [IO_LIMIT_RBPS] = "rbps",
+    [IO_LIMIT_WBPS] = "wbps",
+    [IO_LIMIT_RIOPS] = "riops",
+    [IO_LIMIT_WIOPS] = "wiops"
+};
+// clang-format on
+
+// подбирать осиротевших потомков, пока ждём опустения cgroup
+static bool reap_orphans = false;
+
+// сигнал для мягкой остановки процессов перед SIGKILL
+static int stop_signal = SIGTERM;
+
+// время на мягкую остановку процессов, миллисекунд; 0 - сразу прибивать
+static unsigned int stop_grace_ms = 0;
+
+typedef struct
+{
+    group_dir_t *dir; // каталог cgroup
+    const char *name; // название cgroup относительно корня иерархий
+    int events_fd; // открытый файл cgroup.events или -1 если его нет
+    bool remove; // удалить каталог cgroup или оставить его пустым
+} group_ctx_t;
 
 /*
- * \fn void apply_limits(const char *const dir_path, const unsigned int cpu_usage, const unsigned int mem_usage)
- * \brief Устанавливает заданные ограничения по CPU и памяти.
- * \param const char *const dir_path: Путь к каталогу /cgroup/$group_name.
- * \param const unsigned int cpu_usage: Ограничение по CPU, в процентах.
- * \param const unsigned int mem_usage: Ограничение по памяти, в процентах.
+ * \brief Функция, вызываемая для каждой дочерней cgroup.
+ * \param const char *const child_name: Название каталога дочерней cgroup.
+ * \param void *arg: Произвольный аргумент, переданный в for_each_child().
  */
-static void apply_limits(const char *const dir_path, const unsigned int cpu_usage, const unsigned int mem_usage)
+typedef void (*child_func_t)(const char *const child_name, void *arg);
+
+typedef struct
 {
-    struct sysinfo info;
+    group_dir_t *dir; // каталог родительской cgroup
+    tasks_set_t *set; // набор pidfd прибитых процессов
+    bool populated; // в одной из дочерних cgroup найден процесс
+    bool busy; // одну из дочерних cgroup пока не удалось удалить
+    int signal; // сигнал, посылаемый процессам
+    size_t count; // количество процессов, которым отправлен сигнал
+} tree_ctx_t;
 
-    if (sysinfo(&info) == -1) {
-        LOG_C("Unable to get system information, error '%m'.");
+/*
+ * \fn void open_group(group_dir_t *dir, const char *const name)
+ * \brief Открывает каталог существующей cgroup.
+ * \param group_dir_t *dir: Каталог.
+ * \param const char *const name: Название cgroup относительно корня иерархий.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+static void open_group(group_dir_t *dir, const char *const name)
+{
+    if (group_open(dir, get_root_dir(), name) != 0) {
+        LOG_C("Unable to open group '%s' in '%s', error '%m'.", name, get_root_dir()->name);
         abort();
     }
+}
 
-    LOG_D("System information: RAM %" PRIu64 ", SWAP %" PRIu64 ".", info.totalram, info.totalswap);
+void cgroup_append(const char *const name)
+{
+    group_dir_t dir;
 
-    const char *const cpu_limit_name = "cpu.shares";
-    const char *const mem_limit_name = "memory.limit_in_bytes";
-    const char *const swap_limit_name = "memory.memsw.limit_in_bytes";
+    LOG_D("Adding current process to the existing cgroup '%s'.", name);
 
-    const uint64_t mem_limit = (info.totalram * mem_usage) / 100;
+    open_group(&dir, name);
 
-    const uint64_t swap_limit = (info.totalswap * mem_usage) / 100 + mem_limit;
+    // Помещаем текущий процесс в существующую cgroup.
 
-    uint64_t cpu_limit;
+    save_pid2tasks(&dir);
 
-    if (read_num(&cpu_limit, CGROUP_ROOT_DIR, cpu_limit_name)) {
-        LOG_C("Unable to read CPU limit current value.");
+    group_close(&dir);
+}
+
+void cgroup_limits_init(cgroup_limits_t *limits)
+{
+    limits->cpu_usage = 100;
+    limits->mem_usage = 100;
+    limits->mem_high = 0;
+    limits->cpu_quota = 0;
+    limits->cpu_period_us = CPU_PERIOD_US;
+    limits->cpus = NULL;
+    limits->numa_node = NUMA_NODE_NONE;
+    limits->memory_migrate = false;
+    limits->io_weight = 0;
+    limits->io_max_count = 0;
+    limits->max_tasks = 0;
+}
+
+/*
+ * \fn void apply_tasks_limit(const group_dir_t *const dir, const cgroup_limits_t *const limits)
+ * \brief Устанавливает или сбрасывает ограничение количества процессов и потоков (pids.max).
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ * \note Файл одинаков в v1 и v2. Ограничение не даёт форк-бомбе исчерпать pid'ы системы
+ *       и обогнать kill_all_tasks() при остановке.
+ */
+static void apply_tasks_limit(const group_dir_t *const dir, const cgroup_limits_t *const limits)
+{
+    if (limits->max_tasks != 0) {
+        if (update_num(limits->max_tasks, dir, "pids.max") != 0) {
+            LOG_C("Unable to set tasks limit %u.", limits->max_tasks);
+            abort();
+        }
+
+        return;
+    }
+
+    // Ограничение могло остаться от прошлого запуска. Файла нет, если контроллер pids
+    // не смонтирован (v1) или не включен (v2), тогда и сбрасывать нечего.
+
+    if (dir->reused && group_has_file(dir, "pids.max") && update_str("max\n", dir, "pids.max") != 0) {
+        LOG_C("Unable to reset tasks limit.");
         abort();
     }
+}
+
+/*
+ * \fn bool open_existing_group(group_dir_t *dir, const group_dir_t *const root, const char *const name)
+ * \brief Открывает cgroup, если её каталоги есть во всех иерархиях.
+ * \param group_dir_t *dir: Каталог.
+ * \param const group_dir_t *const root: Корневой каталог.
+ * \param const char *const name: Название cgroup.
+ * \return true - если cgroup открыта; false - если её нужно создать (errno = ENOENT) или ошибка (errno сохраняется).
+ * \note Недоудалённая cgroup может остаться только в основной иерархии, её каталоги досоздаются.
+ */
+static bool open_existing_group(group_dir_t *dir, const group_dir_t *const root, const char *const name)
+{
+    if (group_open(dir, root, name) != 0)
+        return false;
+
+    for (size_t i = 0; i < dir->count; i++) {
+        if (dir->fds[i] == -1) {
+            group_close(dir);
+            errno = ENOENT;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * \fn void setup_group(const char *const name, const cgroup_limits_t *const limits, const bool reuse)
+ * \brief Создаёт cgroup или переиспользует существующую и устанавливает ограничения.
+ * \param const char *const name: Название cgroup.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ * \param const bool reuse: Существующая cgroup ожидаема (перезапуск), а не осталась по ошибке.
+ */
+static void setup_group(const char *const name, const cgroup_limits_t *const limits, const bool reuse)
+{
+    group_dir_t dir;
+    group_dir_t *const root = get_root_dir();
+
+    LOG_D("Creating new cgroup '%s' in '%s'.", name, root->name);
+
+    timing_count(COUNTER_GROUPS, 1);
+
+    uint64_t start_us = timing_start();
+
+    // При перезапуске cgroup почти всегда уже есть, и mkdir(2) в каждой иерархии был бы лишним.
+    bool created = false;
+
+    if (!reuse || !open_existing_group(&dir, root, name)) {
+        if (reuse && errno != ENOENT) {
+            LOG_C("Unable to open group '%s' in '%s', error '%m'.", name, root->name);
+            abort();
+        }
+
+        created = (group_mkdir(root, name) == 0);
+
+        if (!created && errno != EEXIST) {
+            LOG_C("Unable to create directory '%s' in '%s', error '%m'.", name, root->name);
+            abort();
+        }
+
+        open_group(&dir, name);
+    }
+
+    timing_stop(TIMING_MKDIR, start_us);
+
+    if (!created) {
+        if (are_alive_tasks_exist(&dir)) {
+            LOG_C("Directory '%s' is already exist and a few alive tasks have been found in it.", name);
+            abort();
+        }
+
+        if (reuse)
+            LOG_D("Directory '%s' is already exist, reusing the directory.", name);
+        else
+            LOG_E("Directory '%s' is already exist, no alive tasks have been found, reusing the directory.", name);
+
+        // В существующей cgroup ограничения уже заданы, перезаписываем только отличающиеся.
+        dir.reused = true;
+    }
+
+    const cgroup_backend_t *const backend = get_backend();
+
+    start_us = timing_start();
+
+    backend->init_group(root, &dir, limits);
+
+    timing_stop(TIMING_CPUSET, start_us);
+
+    // Устанавливаем ограничения.
+
+    start_us = timing_start();
+
+    backend->apply_limits(root, &dir, limits);
+
+    apply_tasks_limit(&dir, limits);
 
-    cpu_limit = (cpu_limit * cpu_usage) / 100;
+    timing_stop(TIMING_LIMITS, start_us);
 
-    LOG_D("Setting limits: CPU=%" PRIu64 ", RAM %" PRIu64 ", SWAP %" PRIu64 ".", cpu_limit, mem_limit, swap_limit);
+    group_close(&dir);
 
-    assert(cpu_limit != 0);
-    assert(mem_limit != 0);
-    assert(swap_limit != 0);
+    log_flush();
+}
+
+void cgroup_create(const char *const name, const cgroup_limits_t *const limits)
+{
+    setup_group(name, limits, false);
+}
+
+void cgroup_reuse(const char *const name, const cgroup_limits_t *const limits)
+{
+    setup_group(name, limits, true);
+}
+
+pid_t cgroup_fork(const char *const name)
+{
+    group_dir_t dir;
 
-    // WARN: Лимит со свопом должен быть строго >= лимиту оперативки.
-    // Равен он может быть если свопа нет вообще, не считаем это ошибкой!
-    assert(swap_limit >= mem_limit);
+    LOG_D("Forking new process into cgroup '%s'.", name);
+
+    open_group(&dir, name);
+
+    const pid_t pid = fork_into_group(&dir);
+
+    // WARN: В дочернем процессе каталог не закрываем: group_close() при ошибке пишет в лог
+    // и вызывает abort(), а дескрипторы открыты с O_CLOEXEC и закроются при execv(2) сами.
+    if (pid != 0)
+        group_close(&dir);
+
+    return pid;
+}
+
+/*
+ * \fn size_t for_each_child(const group_dir_t *const group, child_func_t func, void *arg)
+ * \brief Вызывает функцию для каждой дочерней cgroup (подкаталога).
+ * \param const group_dir_t *const group: Каталог cgroup.
+ * \param child_func_t func: Функция.
+ * \param void *arg: Аргумент функции.
+ * \return Количество дочерних cgroup.
+ */
+static size_t for_each_child(const group_dir_t *const group, child_func_t func, void *arg)
+{
+    size_t count = 0;
+    struct dirent *entry;
 
-    if (write_num(cpu_limit, dir_path, cpu_limit_name) != 0) {
-        LOG_C("Unable to set CPU limit value %" PRIu64 ".", cpu_limit);
+    // Каталог открыт с O_PATH, читать его нельзя, поэтому переоткрываем через ".".
+    // Дочерние cgroup ищем в основной иерархии, в остальных они повторяют её.
+    const int fd = openat(group->fds[0], ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    DIR *const dir = ((fd == -1) ? NULL : fdopendir(fd));
+
+    if (dir == NULL) {
+        if (errno == ENOENT)
+            return 0;
+
+        LOG_C("Unable to open directory '%s', error '%m'.", group->name);
         abort();
     }
 
-    if (write_num(mem_limit, dir_path, mem_limit_name) != 0) {
-        LOG_C("Unable to set memory limit %" PRIu64 ".", mem_limit);
+    while ((entry = readdir(dir)) != NULL) {
+        // Кроме подкаталогов в каталоге cgroup лежат только обычные файлы.
+        if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        func(entry->d_name, arg);
+        count++;
+    }
+
+    if (closedir(dir) == -1) {
+        LOG_C("Unable to close directory '%s', error '%m'.", group->name);
         abort();
     }
 
-    if (write_num(swap_limit, dir_path, swap_limit_name) != 0) {
-        LOG_C("Unable to set swap limit %" PRIu64 ".", swap_limit);
+    return count;
+}
+
+/*
+ * \fn bool open_child(group_dir_t *child, const group_dir_t *const parent, const char *const child_name)
+ * \brief Открывает каталог дочерней cgroup.
+ * \param group_dir_t *child: Каталог дочерней cgroup.
+ * \param const group_dir_t *const parent: Каталог родительской cgroup.
+ * \param const char *const child_name: Название каталога дочерней cgroup.
+ * \return true - если каталог открыт; false - если он уже удалён.
+ */
+static bool open_child(group_dir_t *child, const group_dir_t *const parent, const char *const child_name)
+{
+    if (group_open(child, parent, child_name) == 0)
+        return true;
+
+    if (errno == ENOENT)
+        return false;
+
+    LOG_C("Unable to open child group '%s' of '%s', error '%m'.", child_name, parent->name);
+    abort();
+}
+
+static bool is_tree_populated(group_dir_t *dir);
+
+static void check_child_populated(const char *const child_name, void *arg)
+{
+    group_dir_t child;
+    tree_ctx_t *const ctx = arg;
+
+    if (ctx->populated)
+        return; // уже найден процесс в одном из потомков
+
+    if (!open_child(&child, ctx->dir, child_name))
+        return;
+
+    ctx->populated = is_tree_populated(&child);
+
+    group_close(&child);
+}
+
+/*
+ * \fn bool is_tree_populated(group_dir_t *dir)
+ * \brief Проверяет, остались ли процессы в cgroup или в любой из её потомков.
+ * \param group_dir_t *dir: Каталог cgroup.
+ * \return true - если есть хотя бы один процесс; false - если нет.
+ */
+static bool is_tree_populated(group_dir_t *dir)
+{
+    if (are_alive_tasks_exist(dir))
+        return true;
+
+    tree_ctx_t ctx = { .dir = dir, .set = NULL, .populated = false };
+
+    for_each_child(dir, check_child_populated, &ctx);
+
+    return ctx.populated;
+}
+
+/*
+ * \fn bool is_group_populated(const group_ctx_t *const ctx)
+ * \brief Проверяет, остались ли в cgroup процессы.
+ * \param const group_ctx_t *const ctx: Контекст cgroup.
+ * \return true - если в cgroup есть хотя бы один процесс; false - если нет.
+ */
+static bool is_group_populated(const group_ctx_t *const ctx)
+{
+    // Прибитые потомки, доставшиеся нам как subreaper'у, должны быть подобраны,
+    // иначе их зомби так и висят в cgroup.
+    if (reap_orphans)
+        reap_children();
+
+    if (ctx->events_fd == -1)
+        return is_tree_populated(ctx->dir);
+
+    char buf[256];
+
+    const ssize_t size = pread(ctx->events_fd, buf, sizeof(buf) - 1, 0);
+
+    if (size == -1) {
+        LOG_C("Unable to read events of group '%s', error '%m'.", ctx->name);
         abort();
     }
+
+    buf[size] = '\0';
+
+    return (strstr(buf, "populated 0") == NULL);
 }
 
-void cgroup_append(const char *const name)
+static void remove_child(const char *const child_name, void *arg)
 {
-    char dir_path[MAX_FILE_PATH];
+    group_dir_t child;
+    tree_ctx_t *const ctx = arg;
 
-    LOG_D("Adding current process to the existing cgroup '%s'.", name);
+    if (!open_child(&child, ctx->dir, child_name))
+        return;
 
-    format_path(dir_path, CGROUP_ROOT_DIR, name);
+    tree_ctx_t child_ctx = { .dir = &child, .busy = false };
 
-    // Помещаем текущий процесс в существующую cgroup.
+    for_each_child(&child, remove_child, &child_ctx);
+
+    group_close(&child);
+
+    if (child_ctx.busy) {
+        ctx->busy = true;
+        return;
+    }
+
+    if (group_rmdir(ctx->dir, child_name) == 0) {
+        LOG_D("Child directory '%s' of '%s' removed successfully.", child_name, ctx->dir->name);
+        return;
+    }
+
+    if (errno == ENOENT)
+        return;
+
+    if (errno != EBUSY) {
+        LOG_C("Unable to remove child directory '%s' of '%s', error '%m'.", child_name, ctx->dir->name);
+        abort();
+    }
 
-    save_pid2tasks(dir_path);
+    timing_count(COUNTER_RMDIR_BUSY, 1);
+
+    ctx->busy = true;
 }
 
-void cgroup_create(const char *const name, const unsigned int cpu_usage, const unsigned int mem_usage)
+/*
+ * \fn bool remove_children(group_dir_t *dir)
+ * \brief Удаляет все дочерние cgroup снизу вверх.
+ * \param group_dir_t *dir: Каталог родительской cgroup.
+ * \return true - если удалены все; false - если какие-то нужно удалить ещё раз.
+ * \note Процессы к этому моменту уже прибиты во всём поддереве, остаются только rmdir(2),
+ *       поэтому дочерние cgroup удаляются в текущем процессе, без исполнителей.
+ */
+static bool remove_children(group_dir_t *dir)
 {
-    char dir_path[MAX_FILE_PATH];
+    tree_ctx_t ctx = { .dir = dir, .busy = false };
 
-    format_path(dir_path, CGROUP_ROOT_DIR, name);
+    for_each_child(dir, remove_child, &ctx);
 
-    LOG_D("Creating new cgroup '%s' in '%s'.", name, CGROUP_ROOT_DIR);
+    return !ctx.busy;
+}
 
-    if (mkdir(dir_path, 0755) == -1) {
-        if (errno != EEXIST) {
-            LOG_C("Unable to create directory '%s', error '%m'.", dir_path);
-            abort();
-        }
+/*
+ * \fn bool try_empty_group(void *arg)
+ * \brief Удаляет дочерние cgroup и, если нужно, каталог самой cgroup, если в них не осталось процессов.
+ * \param void *arg: Контекст cgroup (group_ctx_t).
+ * \return true - если всё удалено; false - если нужно ещё подождать.
+ */
+static bool try_empty_group(void *arg)
+{
+    const group_ctx_t *const ctx = arg;
 
-        if (are_alive_tasks_exist(dir_path)) {
-            LOG_C("Directory '%s' is already exist and a few alive tasks have been found in it.", dir_path);
-            abort();
-        }
+    if (is_group_populated(ctx))
+        return false;
+
+    // Каталог удастся удалить только после всех вложенных в него.
+
+    if (!remove_children(ctx->dir))
+        return false;
+
+    if (!ctx->remove)
+        return true;
 
-        LOG_E("Directory '%s' is already exist, no alive tasks have been found, reusing the directory.", dir_path);
+    if (group_rmdir(get_root_dir(), ctx->name) == 0) {
+        LOG_D("Directory '%s' removed successfully.", ctx->name);
+        return true;
     }
 
-    // Инициализируем созданный cgroup, копируя в него из корневного каталога
-    // содержимое двух файлов - cpuset.cpus и cpuset.mems.
+    if (errno == ENOENT) {
+        LOG_C("Directory '%s' is already removed.", ctx->name);
+        return true;
+    }
 
-    copy_raw_content(CGROUP_ROOT_DIR, dir_path, "cpuset.cpus");
+    /*
+     * WARN: боремся с race-condition!
+     * Было замечено, что даже если ни одного процесса не осталось, то *быстрый*
+     * вызов rmdir(2) сразу после пребивания процессов возвращает EBUSY.
+     * Почему это происходит - до конца не ясно, поэтому просто пробуем ещё раз.
+     */
 
-    copy_raw_content(CGROUP_ROOT_DIR, dir_path, "cpuset.mems");
+    if (errno != EBUSY) {
+        LOG_C("Unable to remove directory '%s', error '%m'.", ctx->name);
+        abort();
+    }
 
-    // Устанавливаем ограничения.
+    timing_count(COUNTER_RMDIR_BUSY, 1);
 
-    apply_limits(dir_path, cpu_usage, mem_usage);
+    return false;
+}
+
+static void kill_child_tasks(const char *const child_name, void *arg)
+{
+    group_dir_t child;
+    const tree_ctx_t *const ctx = arg;
+
+    if (!open_child(&child, ctx->dir, child_name))
+        return;
+
+    tree_ctx_t child_ctx = { .dir = &child, .set = ctx->set, .populated = false };
 
-    // Помещаем текущий процесс в только что созданную cgroup.
+    kill_all_tasks(&child, ctx->set);
 
-    save_pid2tasks(dir_path);
+    for_each_child(&child, kill_child_tasks, &child_ctx);
+
+    group_close(&child);
 }
 
-void cgroup_destroy(const char *const name)
+/*
+ * \fn void kill_tasks(group_dir_t *dir, const char *const name)
+ * \brief Прибивает все процессы в cgroup и во всех её потомках.
+ * \param group_dir_t *dir: Каталог cgroup.
+ * \param const char *const name: Название cgroup.
+ */
+static void kill_tasks(group_dir_t *dir, const char *const name)
 {
-    char dir_path[MAX_FILE_PATH];
+    // Если ядро умеет прибивать cgroup целиком, то ни заморозка, ни обход
+    // списка процессов не нужны.
 
-    format_path(dir_path, CGROUP_ROOT_DIR, name);
+    uint64_t start_us = timing_start();
 
-    for (size_t i = 1; i <= MAX_ATTEMPTS; i++) {
-        /*
-         * Нано-оптимизация: прежде чем пускаться во все тяжкие и прибивать процессы,
-         * пробуем просто удалить каталог cgroup. Если в нём уже нет ни одного процесса,
-         * это получится. Иначе будет ошибка EBUSY.
-         */
-        if (rmdir(dir_path) == 0) {
-            LOG_D("Directory '%s' removed successfully.", dir_path);
-            break;
+    if (kill_group(dir) == 0) {
+        timing_stop(TIMING_KILL, start_us);
+        return;
+    }
+
+    // Заморозка иерархическая: достаточно заморозить верхнюю cgroup один раз,
+    // и замороженными окажутся все её потомки.
+
+    if (freeze_group(dir) != 0) {
+        LOG_C("Unable to freeze cgroup '%s', leaving tasks running.", name);
+        abort();
+    }
+
+    tasks_set_t set = { .count = 0, .killed = 0 };
+
+    tree_ctx_t ctx = { .dir = dir, .set = &set, .populated = false };
+
+    kill_all_tasks(dir, &set);
+
+    for_each_child(dir, kill_child_tasks, &ctx);
+
+    if (unfreeze_group(dir) != 0) {
+        LOG_C("Unable to unfreeze cgroup '%s', leaving tasks frozen.", name);
+        abort();
+    }
+
+    // На v1 ядро не уведомляет об опустевшей cgroup, зато через pidfd
+    // можно точно дождаться завершения каждого прибитого процесса.
+
+    start_us = timing_start();
+
+    if (wait_all_tasks(&set, KILL_ROUND_TIMEOUT_MS) == 0)
+        LOG_D("All %zu killed tasks in group '%s' have exited.", set.killed, name);
+
+    timing_stop(TIMING_WAIT, start_us);
+}
+
+static void signal_child_tasks(const char *const child_name, void *arg)
+{
+    group_dir_t child;
+    tree_ctx_t *const ctx = arg;
+
+    if (!open_child(&child, ctx->dir, child_name))
+        return;
+
+    tree_ctx_t child_ctx = { .dir = &child, .signal = ctx->signal, .count = 0 };
+
+    child_ctx.count = signal_all_tasks(&child, ctx->signal);
+
+    for_each_child(&child, signal_child_tasks, &child_ctx);
+
+    group_close(&child);
+
+    ctx->count += child_ctx.count;
+}
+
+/*
+ * \fn size_t signal_tasks(group_dir_t *dir, const int signal)
+ * \brief Посылает сигнал всем процессам в cgroup и во всех её потомках.
+ * \param group_dir_t *dir: Каталог cgroup.
+ * \param const int signal: Сигнал; 0 - просто посчитать живые процессы.
+ * \return Количество процессов, которым удалось отправить сигнал.
+ */
+static size_t signal_tasks(group_dir_t *dir, const int signal)
+{
+    tree_ctx_t ctx = { .dir = dir, .signal = signal, .count = 0 };
+
+    ctx.count = signal_all_tasks(dir, signal);
+
+    for_each_child(dir, signal_child_tasks, &ctx);
+
+    return ctx.count;
+}
+
+static bool is_group_empty(void *arg)
+{
+    return !is_group_populated(arg);
+}
+
+void cgroup_set_destroy_timeout(const unsigned int timeout_ms)
+{
+    destroy_timeout_ms = timeout_ms;
+}
+
+void cgroup_set_subreaper(void)
+{
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) {
+        LOG_C("Unable to set PR_SET_CHILD_SUBREAPER, error '%m'.");
+        abort();
+    }
+
+    LOG_D("Current process is the child subreaper now.");
+
+    reap_orphans = true;
+}
+
+void cgroup_set_graceful_stop(const int signal, const unsigned int grace_ms)
+{
+    stop_signal = signal;
+    stop_grace_ms = grace_ms;
+}
+
+/*
+ * \fn void report_tasks_limit(const group_dir_t *const dir)
+ * \brief Сообщает, сколько раз cgroup упиралась в ограничение pids.max.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \note Каждое срабатывание - это отказ fork(2) внутри cgroup, т.е. скорее всего
+ *       процессы пытались размножиться сверх меры.
+ */
+static void report_tasks_limit(const group_dir_t *const dir)
+{
+    char buf[MAX_UINT64_STR_SIZE];
+    uint64_t count;
+
+    // Файла нет, если контроллер pids не смонтирован (v1) или не включен (v2).
+
+    if (!group_has_file(dir, "pids.events"))
+        return;
+
+    if (read_str(buf, sizeof(buf), dir, "pids.events") == -1)
+        return;
+
+    if (sscanf(buf, "max %" SCNu64, &count) == 1 && count != 0)
+        LOG_I("Group '%s' hit its tasks limit %" PRIu64 " times.", dir->name, count);
+}
+
+/*
+ * \fn int empty_group(const char *const name, const bool remove)
+ * \brief Прибивает все процессы в cgroup, удаляет дочерние cgroup и, если нужно, саму cgroup.
+ * \note Заморозка и прибивание иерархические и делаются один раз для всего поддерева,
+ *       а дочерние cgroup затем удаляются снизу вверх в пределах того же таймаута.
+ * \param const char *const name: Название cgroup.
+ * \param const bool remove: Удалить каталог cgroup или оставить его пустым.
+ * \return 1 если не удалось уложиться в отведённое время; 0 если всё хорошо.
+ */
+static int empty_group(const char *const name, const bool remove)
+{
+    group_dir_t dir;
+
+    timing_count(COUNTER_GROUPS, 1);
+
+    /*
+     * Нано-оптимизация: прежде чем пускаться во все тяжкие и прибивать процессы,
+     * пробуем просто удалить каталог cgroup. Если в нём уже нет ни одного процесса,
+     * это получится. Иначе будет ошибка EBUSY.
+     */
+    if (remove) {
+        const uint64_t start_us = timing_start();
+        const int ret = group_rmdir(get_root_dir(), name);
+
+        timing_stop(TIMING_RMDIR, start_us);
+
+        if (ret == 0) {
+            LOG_D("Directory '%s' removed successfully.", name);
+            return 0;
         }
 
-        if (errno == ENOENT) {
-            LOG_C("Directory '%s' is already removed.", dir_path);
-            break;
+        if (errno != ENOENT && errno != EBUSY) {
+            LOG_C("Unable to remove directory '%s', error '%m'.", name);
+            abort();
         }
+    }
 
-        if (errno != EBUSY) {
-            LOG_C("Unable to remove directory '%s', error '%m'.", dir_path);
+    if (group_open(&dir, get_root_dir(), name) != 0) {
+        if (errno != ENOENT) {
+            LOG_C("Unable to open group '%s' in '%s', error '%m'.", name, get_root_dir()->name);
             abort();
         }
 
-        LOG_D("Killing orphaned tasks, attempt %zu of %u.", i, MAX_ATTEMPTS);
+        if (remove)
+            LOG_C("Directory '%s' is already removed.", name);
+        else
+            LOG_D("Directory '%s' does not exist, nothing to drain.", name);
 
-        if (freeze_group(dir_path) != 0) {
-            LOG_C("Unable to freeze cgroup '%s', leaving tasks running.", name);
-            abort();
+        return 0;
+    }
+
+    // На unified-иерархии ядро уведомляет об опустевшей cgroup через cgroup.events
+    // ("populated 0"), на v1 такого механизма нет и остаётся только опрос файла tasks.
+
+    group_ctx_t ctx = {
+        .dir = &dir,
+        .name = name,
+        .events_fd = group_file(&dir, GROUP_FILE_EVENTS),
+        .remove = remove
+    };
+
+    if (ctx.events_fd == -1 && errno != ENOENT) {
+        LOG_C("Unable to open events file of group '%s', error '%m'.", name);
+        abort();
+    }
+
+    // Счётчик живёт в каталоге cgroup, поэтому читаем его до удаления.
+
+    report_tasks_limit(&dir);
+
+    int exit_code = 1;
+    size_t signaled = 0; // процессов, получивших сигнал мягкой остановки
+    size_t remaining = 0; // из них оставшихся к моменту SIGKILL
+
+    /*
+     * Мягкая остановка: сначала даём процессам шанс завершиться самостоятельно
+     * (сбросить буферы и т.п.) и ждём опустения cgroup не дольше stop_grace_ms,
+     * а уже потом переходим к заморозке и SIGKILL. Таймаут удаления cgroup
+     * отсчитывается после завершения этой фазы и общий для всего поддерева.
+     * Фаза выполняется один раз для всего поддерева, дочерние cgroup её не повторяют.
+     */
+
+    if (stop_grace_ms != 0 && is_group_populated(&ctx)) {
+        const uint64_t start_us = timing_start();
+
+        signaled = signal_tasks(&dir, stop_signal);
+
+        LOG_D("Sent signal %d to %zu processes of group '%s', waiting up to %u ms.", stop_signal, signaled, name, stop_grace_ms);
+
+        // Оставшиеся процессы пересчитываем, только если они не успели завершиться сами.
+        if (wait_for(is_group_empty, &ctx, ctx.events_fd, stop_grace_ms) != 0)
+            remaining = signal_tasks(&dir, 0);
+
+        timing_stop(TIMING_GRACE, start_us);
+    }
+
+    const uint64_t deadline_us = get_monotonic_us() + (uint64_t) destroy_timeout_ms * 1000;
+
+    for (size_t i = 1;; i++) {
+        const uint64_t now_us = get_monotonic_us();
+
+        if (now_us >= deadline_us) {
+            LOG_E("Unable to %s group '%s' in %u ms, giving up after %zu attempts.", ((remove) ? "remove" : "drain"), name,
+                destroy_timeout_ms, i - 1);
+            break;
         }
 
-        kill_all_tasks(dir_path);
+        if (is_group_populated(&ctx)) {
+            LOG_D("Killing orphaned tasks, attempt %zu.", i);
 
-        if (unfreeze_group(dir_path) != 0) {
-            LOG_C("Unable to unfreeze cgroup '%s', leaving tasks frozen.", name);
-            abort();
+            timing_count(COUNTER_ATTEMPTS, 1);
+
+            kill_tasks(&dir, name);
         }
 
         /*
-         * WARN: боремся с race-condition!
-         * Если в cgroup остались какие-то процессы, то rmdir(2) возвращает ошибку EBUSY.
-         * Это может случиться если какой-то из процессов не удалось убить потому что он стал зомби
-         * или если процесс завис в ожидании возврата syscall.
-         * Также было замечено, что даже если ни одного процесса не осталось, то *быстрый*
-         * вызов rmdir(2) сразу после пребивания процессов возвращает EBUSY.
-         * Почему это происходит - до конца не ясно, поэтому делаем небольшую паузу (200 мс)
-         * между попытками удалить cgroup.
+         * Ждём пока процессы реально завершатся и каталоги поддерева удастся удалить.
+         * Если в cgroup остались какие-то процессы (например, успевшие форкнуться
+         * между чтением tasks и заморозкой), то по истечении раунда прибиваем их снова.
          */
 
-        LOG_D("Some tasks are still active, will retry to kill them after %u us sleep.", ATTEMPTS_DELAY_US);
+        unsigned int round_ms = (deadline_us - now_us + 999) / 1000;
 
-        usleep(ATTEMPTS_DELAY_US);
+        if (round_ms > KILL_ROUND_TIMEOUT_MS)
+            round_ms = KILL_ROUND_TIMEOUT_MS;
+
+        const uint64_t start_us = timing_start();
+
+        const int ret = wait_for(try_empty_group, &ctx, ctx.events_fd, round_ms);
+
+        timing_stop(TIMING_RMDIR, start_us);
+
+        if (ret == 0) {
+            exit_code = 0;
+            break;
+        }
+
+        LOG_D("Some tasks are still active, will retry to kill them.");
     }
+
+    if (signaled != 0)
+        LOG_I("Group '%s': %zu processes exited gracefully, %zu processes killed.", name,
+            ((signaled > remaining) ? signaled - remaining : 0), remaining);
+
+    group_close(&dir);
+
+    // Удаление cgroup - одна операция: здесь пишем, сколько одинаковых записей было подавлено.
+    log_flush();
+
+    return exit_code;
+}
+
+int cgroup_destroy(const char *const name)
+{
+    return empty_group(name, true);
+}
+
+int cgroup_drain(const char *const name)
+{
+    return empty_group(name, false);
 }
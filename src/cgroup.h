@@ -1,6 +1,56 @@
 #ifndef SRC_CGROUP_H_
 #define SRC_CGROUP_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// максимальное количество устройств с ограничениями ввода-вывода.
+#define MAX_IO_DEVICES (8)
+
+// Ограничения ввода-вывода устройства, названия совпадают с ключами io.max.
+typedef enum
+{
+    IO_LIMIT_RBPS = 0, // чтение, байт в секунду
+    IO_LIMIT_WBPS, // запись, байт в секунду
+    IO_LIMIT_RIOPS, // чтение, операций в секунду
+    IO_LIMIT_WIOPS, // запись, операций в секунду
+    IO_LIMITS_COUNT
+} io_limit_t;
+
+// Названия ограничений ввода-вывода, по индексу io_limit_t.
+extern const char *const io_limit_names[IO_LIMITS_COUNT];
+
+typedef struct
+{
+    unsigned int major; // старший номер блочного устройства
+    unsigned int minor; // младший номер блочного устройства
+    uint64_t max[IO_LIMITS_COUNT]; // ограничения по io_limit_t; 0 - без ограничения
+} io_device_limits_t;
+
+typedef struct
+{
+    unsigned int cpu_usage; // ограничение по CPU (относительный вес), в процентах
+    unsigned int mem_usage; // ограничение по памяти, в процентах
+    uint64_t mem_high; // мягкое ограничение по памяти, байт; 0 - без ограничения
+    unsigned int cpu_quota; // жёсткое ограничение по CPU, в тысячных долях ядра; 0 - без ограничения
+    unsigned int cpu_period_us; // период планировщика CFS для cpu_quota, микросекунд
+    const char *cpus; // список CPU для cpuset.cpus; NULL - как у корневой cgroup
+    int numa_node; // узел NUMA для cpuset.mems (и cpus); NUMA_NODE_NONE или NUMA_NODE_AUTO
+    bool memory_migrate; // переносить память процессов при смене cpuset.mems (только v1)
+    unsigned int io_weight; // вес ввода-вывода в шкале io.weight [1..10000]; 0 - по-умолчанию
+    io_device_limits_t io_max[MAX_IO_DEVICES]; // ограничения ввода-вывода по устройствам
+    unsigned int io_max_count; // количество заполненных элементов io_max
+    unsigned int max_tasks; // ограничение количества процессов и потоков в pids.max; 0 - без ограничения
+} cgroup_limits_t;
+
+/*
+ * \fn void cgroup_limits_init(cgroup_limits_t *limits)
+ * \brief Заполняет ограничения значениями по-умолчанию (без ограничений).
+ * \param cgroup_limits_t *limits: Ограничения.
+ */
+void cgroup_limits_init(cgroup_limits_t *limits);
+
 /*
  * \fn void cgroup_append(const char *const name)
  * \brief Добавляет текущий процесс в существующую cgroup.
@@ -9,19 +59,71 @@
 void cgroup_append(const char *const name);
 
 /*
- * \fn cgroup_create(const char *const name, const unsigned int cpu_usage, const unsigned int mem_usage)
- * \brief Создаёт новый cgroup, устанавливает ограничения и помещает текущий процесс в список процессов cgroup.
+ * \fn cgroup_create(const char *const name, const cgroup_limits_t *const limits)
+ * \brief Создаёт новый cgroup и устанавливает ограничения. Процессы в cgroup помещаются
+ *        отдельно: cgroup_append() для текущего процесса или cgroup_fork() для нового.
+ * \param const char *const name: Название cgroup.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ */
+void cgroup_create(const char *const name, const cgroup_limits_t *const limits);
+
+/*
+ * \fn void cgroup_reuse(const char *const name, const cgroup_limits_t *const limits)
+ * \brief То же, что cgroup_create(), но существующая пустая cgroup используется повторно:
+ *        каталог не пересоздаётся, а записываются только отличающиеся ограничения.
+ * \param const char *const name: Название cgroup.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ */
+void cgroup_reuse(const char *const name, const cgroup_limits_t *const limits);
+
+/*
+ * \fn pid_t cgroup_fork(const char *const name)
+ * \brief Создаёт дочерний процесс сразу внутри существующей cgroup.
  * \param const char *const name: Название cgroup.
- * \param const unsigned int cpu_usage: Ограничение по CPU, в процентах.
- * \param const unsigned int mem_usage: Ограничение по памяти, в процентах.
+ * \return Как у fork(2): pid дочернего процесса в родителе, 0 в дочернем, -1 в случае ошибки.
+ * \note На v2 процесс рождается в cgroup атомарно через clone3(CLONE_INTO_CGROUP) и не
+ *       мигрирует; на v1 и старых ядрах дочерний процесс сам переносит себя после fork(2).
+ * \warning В дочернем процессе до execv(2) допустимы только async-signal-safe функции,
+ *          см. fork_into_group().
  */
-void cgroup_create(const char *const name, const unsigned int cpu_usage, const unsigned int mem_usage);
+pid_t cgroup_fork(const char *const name);
 
 /*
- * \fn void cgroup_destroy(const char *const name)
+ * \fn int cgroup_destroy(const char *const name)
  * \brief Прибивает все процессы в cgroup и удаляёт cgroup.
  * \param const char *const name: Название cgroup.
+ * \return 1 если cgroup не удалось удалить за отведённое время; 0 если всё хорошо.
+ */
+int cgroup_destroy(const char *const name);
+
+/*
+ * \fn int cgroup_drain(const char *const name)
+ * \brief Прибивает все процессы в cgroup и удаляет дочерние cgroup, оставляя саму cgroup на месте.
+ * \param const char *const name: Название cgroup.
+ * \return 1 если cgroup не удалось опустошить за отведённое время; 0 если всё хорошо.
+ */
+int cgroup_drain(const char *const name);
+
+/*
+ * \fn void cgroup_set_destroy_timeout(const unsigned int timeout_ms)
+ * \brief Задаёт таймаут удаления cgroup.
+ * \param const unsigned int timeout_ms: Таймаут, миллисекунд.
+ */
+void cgroup_set_destroy_timeout(const unsigned int timeout_ms);
+
+/*
+ * \fn void cgroup_set_subreaper(void)
+ * \brief Делает текущий процесс subreaper'ом: осиротевшие потомки переходят к нему, а не к init,
+ *        и подбираются во время ожидания опустения cgroup.
+ */
+void cgroup_set_subreaper(void);
+
+/*
+ * \fn void cgroup_set_graceful_stop(const int signal, const unsigned int grace_ms)
+ * \brief Включает мягкую остановку: перед SIGKILL процессам посылается сигнал и даётся время завершиться.
+ * \param const int signal: Сигнал мягкой остановки.
+ * \param const unsigned int grace_ms: Время на мягкую остановку, миллисекунд; 0 - выключить.
  */
-void cgroup_destroy(const char *const name);
+void cgroup_set_graceful_stop(const int signal, const unsigned int grace_ms);
 
 #endif /* SRC_CGROUP_H_ */
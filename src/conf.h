@@ -4,7 +4,29 @@
 // оболочка для выполнения init-скриптов
 #define SHELL ("/bin/bash")
 
-// корневой каталог куда смонтированы cgroup
+// предпочтительная точка монтирования cgroup, если иерархия смонтирована в нескольких местах
+// (сами иерархии и их версия определяются в рантайме по /proc/self/mountinfo)
 #define CGROUP_ROOT_DIR ("/cgroup")
 
+// кэш найденных иерархий cgroup, действителен до перезагрузки системы
+#define MOUNTS_CACHE_FILE ("/run/cgctl.mounts")
+
+// таймаут ожидания заморозки/разморозки cgroup по-умолчанию, миллисекунд
+#define FREEZE_TIMEOUT_MS (2000u)
+
+// таймаут удаления cgroup (прибивания всех процессов в ней) по-умолчанию, миллисекунд
+#define DESTROY_TIMEOUT_MS (5000u)
+
+// максимальная длительность одного раунда ожидания завершения прибитых процессов, миллисекунд
+#define KILL_ROUND_TIMEOUT_MS (200u)
+
+// количество групп, удаляемых cgctl-stop параллельно, по-умолчанию
+#define STOP_JOBS (8u)
+
+// период планировщика CFS для жёсткого ограничения CPU по-умолчанию, микросекунд
+#define CPU_PERIOD_US (100000u)
+
+// количество одинаковых записей лога за одну операцию, сверх которого они только считаются
+#define LOG_BURST (8u)
+
 #endif /* SRC_CONF_H_ */
@@ -1,62 +1,158 @@
 // This is a personal academic project. Dear PVS-Studio, please check it.
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 
-#include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "backend.h"
+#include "conf.h"
+#include "freezer.h"
+#include "group.h"
 #include "log.h"
-#include "utils.h"
+#include "timings.h"
+#include "wait.h"
 
-// максимальное количество попыток сколько ждать применения заморозки/разморозки
-#define MAX_ATTEMPTS (10u)
+// таймаут ожидания применения заморозки/разморозки, миллисекунд
+static unsigned int freeze_timeout_ms = FREEZE_TIMEOUT_MS;
 
-// пауза между попытками, микросекунд
-#define ATTEMPTS_DELAY_US (200000u)
+typedef struct
+{
+    int fd; // открытый файл freezer.state или cgroup.events
+    const char *group_name; // название cgroup
+    const char *target_state; // состояние, к которому нужно прийти
+} freezer_state_t;
+
+/*
+ * \fn void read_state(const int fd, const char *const group_name, char *buf, const size_t size)
+ * \brief Перечитывает текущее состояние из файла freezer.state или cgroup.events.
+ * \param const int fd: Открытый файл.
+ * \param const char *const group_name: Название cgroup.
+ * \param char *buf: Буфер для состояния.
+ * \param const size_t size: Размер буфера.
+ */
+static void read_state(const int fd, const char *const group_name, char *buf, const size_t size)
+{
+    char *eol;
+
+    // pread(2) с нулевого смещения заставляет ядро сформировать содержимое файла заново.
+    const ssize_t len = pread(fd, buf, size - 1, 0);
+
+    if (len <= 0) {
+        LOG_C("Unable to read state of group '%s', error '%m'.", group_name);
+        abort();
+    }
+
+    buf[len] = '\0';
+
+    if ((eol = strchr(buf, '\n')) != NULL)
+        *eol = '\0'; // убираем перевод строки
+
+    LOG_D("Got current state '%s' of group '%s'.", buf, group_name);
+}
+
+static bool is_state_reached(void *arg)
+{
+    char buf[16];
+    const freezer_state_t *const state = arg;
+
+    read_state(state->fd, state->group_name, buf, sizeof(buf));
+
+    return (strcmp(buf, state->target_state) == 0);
+}
+
+static bool is_event_reached(void *arg)
+{
+    char buf[256];
+    const freezer_state_t *const events = arg;
+
+    const ssize_t size = pread(events->fd, buf, sizeof(buf) - 1, 0);
+
+    if (size == -1) {
+        LOG_C("Unable to read cgroup.events of group '%s', error '%m'.", events->group_name);
+        abort();
+    }
+
+    buf[size] = '\0';
+
+    return (strstr(buf, events->target_state) != NULL);
+}
+
+/*
+ * \fn int _freeze_group_v2(group_dir_t *dir, const bool do_freeze)
+ * \brief Замораживает/размораживает cgroup через cgroup.freeze, дожидаясь события в cgroup.events.
+ * \param group_dir_t *dir: Каталог cgroup.
+ * \param const bool do_freeze: Заморозить или разморозить.
+ * \return 1 в случае ошибки; 0 если всё хорошо.
+ */
+static int _freeze_group_v2(group_dir_t *dir, const bool do_freeze)
+{
+    LOG_D("Going to %s group '%s' via cgroup.freeze.", ((do_freeze) ? "freeze" : "unfreeze"), dir->name);
+
+    const int events_fd = group_file(dir, GROUP_FILE_EVENTS);
+
+    if (events_fd == -1) {
+        LOG_C("Unable to open events file of group '%s', error '%m'.", dir->name);
+        abort();
+    }
+
+    const int freeze_fd = group_file(dir, GROUP_FILE_FREEZER);
+
+    if (freeze_fd == -1 || pwrite(freeze_fd, ((do_freeze) ? "1\n" : "0\n"), 2, 0) != 2) {
+        LOG_C("Unable to write freeze state to group '%s', error '%m'.", dir->name);
+        abort();
+    }
+
+    freezer_state_t events = {
+        .fd = events_fd,
+        .group_name = dir->name,
+        .target_state = ((do_freeze) ? "frozen 1" : "frozen 0")
+    };
+
+    const int exit_code = wait_for(is_event_reached, &events, events_fd, freeze_timeout_ms);
+
+    if (exit_code == 0)
+        LOG_D("Group '%s' has been %s successfully.", dir->name, ((do_freeze) ? "frozen" : "unfrozen"));
 
-static int _freeze_group(const char *const dir_path, const bool do_freeze)
+    return exit_code;
+}
+
+static int _freeze_group(group_dir_t *dir, const bool do_freeze)
 {
     static const char *const frozen_state = "FROZEN";
     static const char *const thawed_state = "THAWED";
 
-    char *eol;
     char buf[16];
-    int exit_code = 1;
-    char file_path[MAX_FILE_PATH];
     const char *target_state; // состояние, к которому нужно прийти
     const char *current_state; // состояние, в котором cgroup находится сейчас
 
+    // На unified-иерархии нет freezer.state, зато есть cgroup.freeze с уведомлениями.
+
+    if (get_backend()->version == 2)
+        return _freeze_group_v2(dir, do_freeze);
+
     if (do_freeze) {
         target_state = frozen_state;
         current_state = thawed_state;
-        LOG_D("Going to freeze group '%s', changing state: %s => %s.", dir_path, current_state, target_state);
+        LOG_D("Going to freeze group '%s', changing state: %s => %s.", dir->name, current_state, target_state);
     } else {
         target_state = thawed_state;
         current_state = frozen_state;
-        LOG_D("Going to unfreeze group '%s', changing state: %s => %s.", dir_path, current_state, target_state);
+        LOG_D("Going to unfreeze group '%s', changing state: %s => %s.", dir->name, current_state, target_state);
     }
 
-    format_path(file_path, dir_path, "freezer.state");
+    // Файл freezer.state открывается один раз и переиспользуется всеми циклами
+    // заморозки/разморозки этой cgroup.
 
-    FILE *const fp = fopen(file_path, "r+e");
+    const int fd = group_file(dir, GROUP_FILE_FREEZER);
 
-    if (fp == NULL) {
-        LOG_C("Unable to open freezer file '%s', error '%m'.", file_path);
+    if (fd == -1) {
+        LOG_C("Unable to open freezer file of group '%s', error '%m'.", dir->name);
         abort();
     }
 
-    setbuf(fp, NULL);
-
-    if (fgets(buf, sizeof(buf), fp) == NULL) {
-        LOG_C("Unable to read line from '%s', error '%m'.", file_path);
-        abort();
-    }
-
-    if ((eol = strchr(buf, '\n')) != NULL)
-        *eol = '\0'; // убираем перевод строки
-
-    LOG_D("Got current state '%s' from '%s'.", buf, file_path);
+    read_state(fd, dir->name, buf, sizeof(buf));
 
     // WARN: текущее состояние не совпадает с ожидаемым - панико!
     if (strcmp(buf, current_state) != 0) {
@@ -64,64 +160,63 @@ static int _freeze_group(const char *const dir_path, const bool do_freeze)
         abort();
     }
 
-    LOG_D("Writing state %s to file '%s'.", target_state, file_path);
+    LOG_D("Writing state %s to group '%s'.", target_state, dir->name);
 
-    if (fseek(fp, 0, SEEK_SET) != 0) {
-        LOG_C("Unable to move file '%s' to the beginning, error '%m'.", file_path);
-        abort();
-    }
+    const size_t len = strlen(target_state);
 
-    if (fprintf(fp, "%s\n", target_state) != (int) (strlen(target_state) + 1)) { // +1 на перевод строки
-        LOG_C("Unable to write target state %s to file '%s', error '%m'.", target_state, file_path);
+    if (pwrite(fd, target_state, len, 0) != (ssize_t) len) {
+        LOG_C("Unable to write target state %s to group '%s', error '%m'.", target_state, dir->name);
         abort();
     }
 
     // WARN: После смены состояния путём записи в файл дожидаемся пока оно реально сменится.
-    // Это может занять некоторое время.
-
-    for (size_t i = 1; i <= MAX_ATTEMPTS; i++) {
-        LOG_D("Waiting for state change from %s to %s, attempt %zu of %u.", current_state, target_state, i, MAX_ATTEMPTS);
+    // Это может занять некоторое время. Уведомлений freezer.state не поддерживает,
+    // поэтому опрашиваем его с нарастающими паузами.
 
-        if (fseek(fp, 0, SEEK_SET) != 0) {
-            LOG_C("Unable to move file '%s' to the beginning, error '%m'.", file_path);
-            abort();
-        }
+    freezer_state_t state = {
+        .fd = fd,
+        .group_name = dir->name,
+        .target_state = target_state
+    };
 
-        if (fgets(buf, sizeof(buf), fp) == NULL) {
-            LOG_C("Unable to read line from '%s', error '%m'.", file_path);
-            abort();
-        }
+    const int exit_code = wait_for(is_state_reached, &state, -1, freeze_timeout_ms);
 
-        if ((eol = strchr(buf, '\n')) != NULL)
-            *eol = '\0'; // убираем перевод строки
+    if (exit_code == 0)
+        LOG_D("Group '%s' has been %s successfully.", dir->name, ((do_freeze) ? "frozen" : "unfrozen"));
 
-        LOG_D("Got current state '%s' from '%s'.", buf, file_path);
+    return exit_code;
+}
 
-        if (strcmp(buf, target_state) == 0) {
-            LOG_D("Group '%s' has been %s successfully.", dir_path, ((do_freeze) ? "frozen" : "unfrozen"));
-            exit_code = 0;
-            break;
-        }
+void freezer_set_timeout(const unsigned int timeout_ms)
+{
+    freeze_timeout_ms = timeout_ms;
+}
 
-        LOG_D("Intermediate state '%s', will retry after pause %u us.", buf, ATTEMPTS_DELAY_US);
+/*
+ * \fn int timed_freeze_group(group_dir_t *dir, const bool do_freeze)
+ * \brief Замораживает/размораживает cgroup, учитывая время в фазе заморозки.
+ * \param group_dir_t *dir: Каталог cgroup.
+ * \param const bool do_freeze: Заморозить или разморозить.
+ * \return 1 в случае ошибки; 0 если всё хорошо.
+ */
+static int timed_freeze_group(group_dir_t *dir, const bool do_freeze)
+{
+    const uint64_t start_us = timing_start();
 
-        usleep(ATTEMPTS_DELAY_US);
-    }
+    const int exit_code = _freeze_group(dir, do_freeze);
 
-    if (fclose(fp) == EOF) {
-        LOG_C("Unable to close file '%s', error '%m'.", file_path);
-        abort();
-    }
+    timing_stop(TIMING_FREEZE, start_us);
+    timing_count(COUNTER_FREEZES, 1);
 
     return exit_code;
 }
 
-int freeze_group(const char *const dir_path)
+int freeze_group(group_dir_t *dir)
 {
-    return _freeze_group(dir_path, true);
+    return timed_freeze_group(dir, true);
 }
 
-int unfreeze_group(const char *const dir_path)
+int unfreeze_group(group_dir_t *dir)
 {
-    return _freeze_group(dir_path, false);
+    return timed_freeze_group(dir, false);
 }
@@ -1,20 +1,29 @@
 #ifndef SRC_FREEZER_H_
 #define SRC_FREEZER_H_
 
+#include "group.h"
+
 /*
- * \fn int freeze_group(const char *const dir_path)
+ * \fn int freeze_group(group_dir_t *dir)
  * \brief "Замораживает" заданную cgroup.
- * \param const char *const dir_path: Путь к каталогу с cgroup.
+ * \param group_dir_t *dir: Каталог cgroup.
  * \return 1 в случае ошибки; 0 если всё хорошо.
  */
-int freeze_group(const char *const dir_path);
+int freeze_group(group_dir_t *dir);
 
 /*
- * \fn int freeze_group(const char *const dir_path)
+ * \fn int unfreeze_group(group_dir_t *dir)
  * \brief "Размораживает" заданную cgroup.
- * \param const char *const dir_path: Путь к каталогу с cgroup.
+ * \param group_dir_t *dir: Каталог cgroup.
  * \return 1 в случае ошибки; 0 если всё хорошо.
  */
-int unfreeze_group(const char *const dir_path);
+int unfreeze_group(group_dir_t *dir);
+
+/*
+ * \fn void freezer_set_timeout(const unsigned int timeout_ms)
+ * \brief Задаёт таймаут ожидания заморозки/разморозки cgroup.
+ * \param const unsigned int timeout_ms: Таймаут, миллисекунд.
+ */
+void freezer_set_timeout(const unsigned int timeout_ms);
 
 #endif /* SRC_FREEZER_H_ */
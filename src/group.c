@@ -0,0 +1,471 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "conf.h"
+#include "group.h"
+#include "log.h"
+#include "utils.h"
+
+int group_open(group_dir_t *dir, const group_dir_t *const parent, const char *const name)
+{
+    dir->name = name;
+    dir->reused = false;
+    dir->missing = 0;
+    dir->count = ((parent == NULL) ? 1 : parent->count);
+
+    for (size_t i = 0; i < GROUP_FILES_COUNT; i++)
+        dir->files[i] = -1;
+
+    for (size_t i = 0; i < MAX_HIERARCHIES; i++)
+        dir->fds[i] = -1;
+
+    for (size_t i = 0; i < dir->count; i++) {
+        if (parent != NULL && parent->fds[i] == -1)
+            continue;
+
+        // O_PATH: каталог нужен только как точка отсчёта для openat(2), читать его не нужно.
+        dir->fds[i] = openat(((parent == NULL) ? AT_FDCWD : parent->fds[i]), name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+        // Дочерние cgroup, созданные самими процессами, могут быть не во всех иерархиях.
+        if (dir->fds[i] != -1 || (i != 0 && errno == ENOENT))
+            continue;
+
+        const int saved_errno = errno;
+
+        if (errno != ENOENT)
+            LOG_E("Unable to open group directory '%s', error '%m'.", name);
+
+        for (size_t j = 0; j < i; j++)
+            if (dir->fds[j] != -1)
+                close(dir->fds[j]);
+
+        errno = saved_errno;
+        return 1;
+    }
+
+    return 0;
+}
+
+void group_close(group_dir_t *dir)
+{
+    for (size_t i = 0; i < GROUP_FILES_COUNT; i++) {
+        if (dir->files[i] != -1 && close(dir->files[i]) == -1) {
+            LOG_C("Unable to close file of group '%s', error '%m'.", dir->name);
+            abort();
+        }
+
+        dir->files[i] = -1;
+    }
+
+    for (size_t i = 0; i < dir->count; i++) {
+        if (dir->fds[i] != -1 && close(dir->fds[i]) == -1) {
+            LOG_C("Unable to close group directory '%s', error '%m'.", dir->name);
+            abort();
+        }
+
+        dir->fds[i] = -1;
+    }
+}
+
+/*
+ * \fn int open_root_dir(group_dir_t *root, const cgroup_mounts_t *const mounts)
+ * \brief Открывает корневые каталоги всех иерархий.
+ * \param group_dir_t *root: Корневой каталог.
+ * \param const cgroup_mounts_t *const mounts: Иерархии.
+ * \return 1 в случае ошибки (errno сохраняется); 0 если все каталоги открыты.
+ */
+static int open_root_dir(group_dir_t *root, const cgroup_mounts_t *const mounts)
+{
+    if (group_open(root, NULL, mounts->paths[0]) != 0)
+        return 1;
+
+    for (root->count = 1; root->count < mounts->count; root->count++) {
+        root->fds[root->count] = open(mounts->paths[root->count], O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+        if (root->fds[root->count] == -1) {
+            const int saved_errno = errno;
+
+            LOG_E("Unable to open group directory '%s', error '%m'.", mounts->paths[root->count]);
+
+            group_close(root);
+            errno = saved_errno;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+group_dir_t *get_root_dir(void)
+{
+    static group_dir_t root = { .count = 0 };
+
+    if (root.count != 0)
+        return &root;
+
+    // Иерархии из кэша могли перемонтировать без перезагрузки, тогда ищем их заново.
+
+    if (open_root_dir(&root, get_mounts()) != 0 && (!reload_mounts() || open_root_dir(&root, get_mounts()) != 0)) {
+        LOG_C("Unable to open root directory '%s', error '%m'.", get_mounts()->paths[0]);
+        abort();
+    }
+
+    return &root;
+}
+
+int group_mkdir(const group_dir_t *const root, const char *const name)
+{
+    int exit_code = 0;
+
+    for (size_t i = 0; i < root->count; i++) {
+        if (mkdirat(root->fds[i], name, 0755) == 0)
+            continue;
+
+        if (errno != EEXIST)
+            return 1;
+
+        // Каталог в основной иерархии определяет, новая это cgroup или нет.
+        if (i == 0)
+            exit_code = 1;
+    }
+
+    if (exit_code != 0)
+        errno = EEXIST;
+
+    return exit_code;
+}
+
+int group_rmdir(const group_dir_t *const root, const char *const name)
+{
+    // Основную иерархию удаляем последней: пока каталог в ней есть, cgroup считается
+    // существующей, и повторная попытка удалит то, что осталось в остальных.
+
+    // У дочерних cgroup, созданных самими процессами, каталогов может не быть в части иерархий.
+
+    for (size_t i = root->count - 1; i > 0; i--)
+        if (root->fds[i] != -1 && unlinkat(root->fds[i], name, AT_REMOVEDIR) == -1 && errno != ENOENT)
+            return 1;
+
+    return ((unlinkat(root->fds[0], name, AT_REMOVEDIR) == 0) ? 0 : 1);
+}
+
+int group_fd(const group_dir_t *const dir, const char *const file_name)
+{
+    return ((dir->count == 1) ? dir->fds[0] : dir->fds[get_file_hierarchy(file_name)]);
+}
+
+bool group_has_file(const group_dir_t *const dir, const char *const file_name)
+{
+    const int fd = group_fd(dir, file_name);
+
+    return (fd != -1 && faccessat(fd, file_name, F_OK, 0) == 0);
+}
+
+/*
+ * \fn const char *get_file_name(const group_file_t file)
+ * \brief Возвращает название часто используемого файла cgroup в текущей версии cgroup.
+ * \param const group_file_t file: Файл.
+ * \return Название файла; NULL если в этой версии cgroup его нет.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+static const char *get_file_name(const group_file_t file)
+{
+    const cgroup_backend_t *const backend = get_backend();
+
+    switch (file) {
+        case GROUP_FILE_FREEZER:
+            return backend->freezer_file;
+
+        case GROUP_FILE_EVENTS:
+            return backend->events_file;
+
+        case GROUP_FILE_PROCS:
+            return "cgroup.procs";
+
+        case GROUP_FILE_CPU_USAGE:
+        case GROUP_FILE_CPU_STAT:
+        case GROUP_FILE_MEM_USAGE:
+        case GROUP_FILE_MEM_PEAK:
+        case GROUP_FILE_MEM_STAT:
+        case GROUP_FILE_SWAP:
+            return backend->stat_files[file];
+
+        default:
+            LOG_C("Unknown group file %d.", file);
+            abort();
+    }
+}
+
+int group_file(group_dir_t *dir, const group_file_t file)
+{
+    if (dir->files[file] != -1)
+        return dir->files[file];
+
+    if ((dir->missing & (1u << file)) != 0) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    const char *const file_name = get_file_name(file);
+    const int flags = ((file == GROUP_FILE_FREEZER) ? O_RDWR : O_RDONLY);
+
+    if (file_name == NULL) {
+        dir->missing |= 1u << file;
+        errno = ENOENT;
+        return -1;
+    }
+
+    dir->files[file] = open_file(dir, file_name, flags);
+
+    if (dir->files[file] == -1 && errno == ENOENT)
+        dir->missing |= 1u << file;
+    else if (dir->files[file] == -1)
+        LOG_E("Unable to open file '%s' of group '%s', error '%m'.", file_name, dir->name);
+
+    return dir->files[file];
+}
+
+int open_file(const group_dir_t *const dir, const char *const file_name, const int flags)
+{
+    const int fd = group_fd(dir, file_name);
+
+    if (fd == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    return openat(fd, file_name, flags | O_CLOEXEC);
+}
+
+int read_num(uint64_t *out_value, const group_dir_t *const dir, const char *const file_name)
+{
+    const int fd = open_file(dir, file_name, O_RDONLY);
+
+    if (fd == -1) {
+        LOG_E("Unable to open file '%s' of group '%s', error '%m'.", file_name, dir->name);
+        return 1;
+    }
+
+    int exit_code = 1;
+    char buf[MAX_UINT64_STR_SIZE];
+
+    const ssize_t size = read(fd, buf, sizeof(buf) - 1);
+
+    if (size <= 0) {
+        LOG_E("Unable to read line from file '%s' of group '%s', error '%m'.", file_name, dir->name);
+
+    } else {
+        buf[size] = '\0';
+        *out_value = str2uint(buf);
+        LOG_D("Got value %" PRIu64 " from '%s' of group '%s'.", *out_value, file_name, dir->name);
+        exit_code = 0;
+    }
+
+    if (close(fd) == -1) {
+        LOG_C("Unable to close file '%s' of group '%s', error '%m'.", file_name, dir->name);
+        abort();
+    }
+
+    return exit_code;
+}
+
+int write_num(const uint64_t value, const group_dir_t *const dir, const char *const file_name)
+{
+    char buf[MAX_UINT64_STR_SIZE];
+
+    if (snprintf(buf, sizeof(buf), "%" PRIu64 "\n", value) <= 0) {
+        LOG_C("Unable to format value %" PRIu64 ", error '%m'.", value);
+        abort();
+    }
+
+    return write_str(buf, dir, file_name);
+}
+
+int write_str(const char *const value, const group_dir_t *const dir, const char *const file_name)
+{
+    const int fd = open_file(dir, file_name, O_WRONLY);
+
+    if (fd == -1) {
+        LOG_E("Unable to open file '%s' of group '%s', error '%m'.", file_name, dir->name);
+        return 1;
+    }
+
+    int exit_code = 1;
+    const size_t size = strlen(value);
+
+    LOG_D("Writing value '%.*s' to '%s' of group '%s'.", (int) strcspn(value, "\n"), value, file_name, dir->name);
+
+    // WARN: Пишем одним вызовом write(2): cgroup разбирает каждую запись целиком.
+    if (write(fd, value, size) != (ssize_t) size)
+        LOG_E("Unable to write value '%s' to file '%s' of group '%s', error '%m'.", value, file_name, dir->name);
+    else
+        exit_code = 0;
+
+    if (close(fd) == -1) {
+        LOG_C("Unable to close file '%s' of group '%s', error '%m'.", file_name, dir->name);
+        abort();
+    }
+
+    return exit_code;
+}
+
+int write_num_all(const uint64_t value, const group_dir_t *const dir, const char *const file_name)
+{
+    char buf[MAX_UINT64_STR_SIZE];
+
+    if (snprintf(buf, sizeof(buf), "%" PRIu64 "\n", value) <= 0) {
+        LOG_C("Unable to format value %" PRIu64 ", error '%m'.", value);
+        abort();
+    }
+
+    const ssize_t size = strlen(buf);
+
+    LOG_D("Writing value %" PRIu64 " to '%s' of group '%s' in %zu hierarchies.", value, file_name, dir->name, dir->count);
+
+    for (size_t i = dir->count; i-- > 0;) {
+        if (dir->fds[i] == -1)
+            continue;
+
+        const int fd = openat(dir->fds[i], file_name, O_WRONLY | O_CLOEXEC);
+
+        if (fd == -1) {
+            LOG_E("Unable to open file '%s' of group '%s', error '%m'.", file_name, dir->name);
+            return 1;
+        }
+
+        const bool written = (write(fd, buf, size) == size);
+
+        if (!written)
+            LOG_E("Unable to write value %" PRIu64 " to file '%s' of group '%s', error '%m'.", value, file_name, dir->name);
+
+        if (close(fd) == -1) {
+            LOG_C("Unable to close file '%s' of group '%s', error '%m'.", file_name, dir->name);
+            abort();
+        }
+
+        if (!written)
+            return 1;
+    }
+
+    return 0;
+}
+
+ssize_t read_str(char *buf, const size_t size, const group_dir_t *const dir, const char *const file_name)
+{
+    const int fd = open_file(dir, file_name, O_RDONLY);
+
+    if (fd == -1) {
+        LOG_E("Unable to open file '%s' of group '%s', error '%m'.", file_name, dir->name);
+        return -1;
+    }
+
+    const ssize_t len = read(fd, buf, size - 1);
+
+    if (len == -1)
+        LOG_E("Unable to read file '%s' of group '%s', error '%m'.", file_name, dir->name);
+    else
+        buf[len] = '\0';
+
+    if (close(fd) == -1) {
+        LOG_C("Unable to close file '%s' of group '%s', error '%m'.", file_name, dir->name);
+        abort();
+    }
+
+    return len;
+}
+
+ssize_t read_group_file(char *buf, const size_t size, group_dir_t *dir, const group_file_t file)
+{
+    const int fd = group_file(dir, file);
+
+    *buf = '\0';
+
+    if (fd == -1)
+        return ((errno == ENOENT) ? 0 : -1);
+
+    // Файлы cgroup формируются ядром заново при чтении с нулевого смещения.
+    const ssize_t len = pread(fd, buf, size - 1, 0);
+
+    if (len == -1)
+        LOG_E("Unable to read file '%s' of group '%s', error '%m'.", get_file_name(file), dir->name);
+    else
+        buf[len] = '\0';
+
+    return len;
+}
+
+int update_num(const uint64_t value, const group_dir_t *const dir, const char *const file_name)
+{
+    char buf[MAX_UINT64_STR_SIZE];
+
+    if (snprintf(buf, sizeof(buf), "%" PRIu64 "\n", value) <= 0) {
+        LOG_C("Unable to format value %" PRIu64 ", error '%m'.", value);
+        abort();
+    }
+
+    return update_str(buf, dir, file_name);
+}
+
+int update_str(const char *const value, const group_dir_t *const dir, const char *const file_name)
+{
+    char buf[256];
+
+    // WARN: Сравниваем строки, а не числа: "max" и 0 для ядра - разные значения.
+    if (dir->reused && read_str(buf, sizeof(buf), dir, file_name) != -1 && strcmp(buf, value) == 0) {
+        LOG_D("File '%s' of group '%s' is up to date, skipping.", file_name, dir->name);
+        return 0;
+    }
+
+    return write_str(value, dir, file_name);
+}
+
+void copy_raw_content(const group_dir_t *const src_dir, const group_dir_t *const dst_dir, const char *const file_name)
+{
+    char src_buf[1024]; // данных в файле гарантированно менее одного килобайта
+    char dst_buf[1024];
+
+    LOG_D("Copying file '%s' from group '%s' to '%s'.", file_name, src_dir->name, dst_dir->name);
+
+    const ssize_t len = read_str(src_buf, sizeof(src_buf), src_dir, file_name);
+
+    if (len == -1) {
+        LOG_C("Unable to read source file '%s' of group '%s'.", file_name, src_dir->name);
+        abort();
+    }
+
+    if (dst_dir->reused && read_str(dst_buf, sizeof(dst_buf), dst_dir, file_name) != -1 && strcmp(src_buf, dst_buf) == 0) {
+        LOG_D("File '%s' of group '%s' is up to date, skipping.", file_name, dst_dir->name);
+        return;
+    }
+
+    const int out_fd = open_file(dst_dir, file_name, O_WRONLY);
+
+    // WARN: При ошибках дескрипторы не закрываем потому что всё равно собираемся падать!
+
+    if (out_fd == -1) {
+        LOG_C("Unable to open destination file '%s' of group '%s': error '%m'.", file_name, dst_dir->name);
+        abort();
+    }
+
+    if (write(out_fd, src_buf, len) != len) {
+        LOG_C("Unable to copy content of file '%s' from group '%s' to '%s': error '%m'.", file_name, src_dir->name, dst_dir->name);
+        abort();
+    }
+
+    if (close(out_fd) == -1) {
+        LOG_C("Unable to close destination file '%s' of group '%s': error '%m'.", file_name, dst_dir->name);
+        abort();
+    }
+
+    LOG_D("File '%s' has been copied successfully from group '%s' to '%s'.", file_name, src_dir->name, dst_dir->name);
+}
@@ -0,0 +1,227 @@
+#ifndef SRC_GROUP_H_
+#define SRC_GROUP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "mounts.h"
+
+/*
+ * Файлы cgroup, к которым обращаемся многократно за время работы с группой.
+ * Они открываются один раз при первом обращении и закрываются вместе с каталогом.
+ */
+typedef enum
+{
+    GROUP_FILE_FREEZER = 0, // freezer.state (v1) или cgroup.freeze (v2)
+    GROUP_FILE_EVENTS, // cgroup.events (только v2)
+    GROUP_FILE_PROCS, // cgroup.procs, перечитывается только на v2, см. count_tasks()
+    // файлы статистики, см. cgroup_backend_t.stat_files
+    GROUP_FILE_CPU_USAGE, // cpuacct.usage (только v1)
+    GROUP_FILE_CPU_STAT, // cpu.stat
+    GROUP_FILE_MEM_USAGE, // memory.usage_in_bytes (v1) или memory.current (v2)
+    GROUP_FILE_MEM_PEAK, // memory.max_usage_in_bytes (v1) или memory.peak (v2)
+    GROUP_FILE_MEM_STAT, // memory.stat
+    GROUP_FILE_SWAP, // memory.swap.current (только v2)
+    GROUP_FILES_COUNT
+} group_file_t;
+
+/*
+ * Открытый каталог cgroup. Все файлы cgroup открываются относительно него через
+ * openat(2), поэтому путь к каталогу не нужно ни собирать, ни разбирать ядру заново.
+ * На v1 контроллеры могут быть смонтированы в разные иерархии, тогда у cgroup по
+ * каталогу в каждой из них, и файл открывается в иерархии своего контроллера.
+ */
+typedef struct
+{
+    int fds[MAX_HIERARCHIES]; // каталоги cgroup в каждой иерархии, открытые с O_PATH, или -1; [0] - основной
+    size_t count; // количество иерархий
+    int files[GROUP_FILES_COUNT]; // открытые файлы cgroup или -1
+    unsigned int missing; // битовая маска файлов из files, которых в cgroup нет: их не пытаемся открыть снова
+    const char *name; // название cgroup, используется только в сообщениях
+    bool reused; // cgroup уже существовала: ограничения перезаписываются, только если отличаются
+} group_dir_t;
+
+/*
+ * \fn int group_open(group_dir_t *dir, const group_dir_t *const parent, const char *const name)
+ * \brief Открывает каталог cgroup во всех иерархиях родителя.
+ * \param group_dir_t *dir: Каталог.
+ * \param const group_dir_t *const parent: Родительский каталог; NULL - если name это полный путь
+ *        к единственному каталогу.
+ * \param const char *const name: Название cgroup относительно родительского каталога.
+ * \return 1 в случае ошибки (errno сохраняется); 0 если каталог открыт успешно.
+ * \note Строка name должна жить, пока каталог открыт. Обязателен только каталог в основной
+ *       иерархии, отсутствующие в остальных пропускаются.
+ */
+int group_open(group_dir_t *dir, const group_dir_t *const parent, const char *const name);
+
+/*
+ * \fn void group_close(group_dir_t *dir)
+ * \brief Закрывает каталог cgroup и все открытые в нём файлы.
+ * \param group_dir_t *dir: Каталог.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+void group_close(group_dir_t *dir);
+
+/*
+ * \fn group_dir_t *get_root_dir(void)
+ * \brief Возвращает корневые каталоги всех иерархий cgroup, открывая их при первом вызове.
+ * \return Корневой каталог, его name - путь к основной иерархии.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+group_dir_t *get_root_dir(void);
+
+/*
+ * \fn int group_mkdir(const group_dir_t *const root, const char *const name)
+ * \brief Создаёт каталог cgroup во всех иерархиях.
+ * \param const group_dir_t *const root: Корневой каталог.
+ * \param const char *const name: Название cgroup.
+ * \return 1 в случае ошибки (errno сохраняется, EEXIST - каталог в основной иерархии уже был);
+ *         0 если каталог создан.
+ * \note Уже существующие каталоги в остальных иерархиях ошибкой не считаются.
+ */
+int group_mkdir(const group_dir_t *const root, const char *const name);
+
+/*
+ * \fn int group_rmdir(const group_dir_t *const root, const char *const name)
+ * \brief Удаляет каталог cgroup во всех иерархиях, основную - последней.
+ * \param const group_dir_t *const root: Корневой каталог или каталог родительской cgroup.
+ * \param const char *const name: Название cgroup относительно root.
+ * \return 1 в случае ошибки (errno сохраняется); 0 если каталог удалён.
+ * \note Отсутствующие каталоги в остальных иерархиях ошибкой не считаются.
+ */
+int group_rmdir(const group_dir_t *const root, const char *const name);
+
+/*
+ * \fn int group_fd(const group_dir_t *const dir, const char *const file_name)
+ * \brief Возвращает каталог cgroup в иерархии, где лежит файл.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \return Дескриптор каталога; -1 если в этой иерархии каталога нет.
+ */
+int group_fd(const group_dir_t *const dir, const char *const file_name);
+
+/*
+ * \fn bool group_has_file(const group_dir_t *const dir, const char *const file_name)
+ * \brief Проверяет, есть ли в cgroup файл (например, смонтирован ли его контроллер).
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \return true - если файл есть; false - если нет.
+ */
+bool group_has_file(const group_dir_t *const dir, const char *const file_name);
+
+/*
+ * \fn int group_file(group_dir_t *dir, const group_file_t file)
+ * \brief Возвращает дескриптор часто используемого файла cgroup, открывая его при первом обращении.
+ * \param group_dir_t *dir: Каталог cgroup.
+ * \param const group_file_t file: Файл.
+ * \return Дескриптор файла; -1 в случае ошибки (ENOENT - если файла в этой версии cgroup нет).
+ */
+int group_file(group_dir_t *dir, const group_file_t file);
+
+/*
+ * \fn int open_file(const group_dir_t *const dir, const char *const file_name, const int flags)
+ * \brief Открывает файл в каталоге cgroup.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \param const int flags: Флаги open(2), O_CLOEXEC добавляется всегда.
+ * \return Дескриптор файла; -1 в случае ошибки.
+ */
+int open_file(const group_dir_t *const dir, const char *const file_name, const int flags);
+
+/*
+ * \fn int read_num(uint64_t *out_value, const group_dir_t *const dir, const char *const file_name)
+ * \brief Читает целочисленное значение из файла cgroup.
+ * \param uint64_t *out_value: Указатель на переменную, в которую будет помещено прочитанное значение.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \return 1 в случае ошибок; 0 если значение прочитано успешно.
+ */
+int read_num(uint64_t *out_value, const group_dir_t *const dir, const char *const file_name);
+
+/*
+ * \fn ssize_t read_str(char *buf, const size_t size, const group_dir_t *const dir, const char *const file_name)
+ * \brief Читает содержимое небольшого файла cgroup целиком.
+ * \param char *buf: Буфер, в который помещается содержимое, всегда завершается '\0'.
+ * \param const size_t size: Размер буфера.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \return Длина содержимого; -1 в случае ошибки.
+ */
+ssize_t read_str(char *buf, const size_t size, const group_dir_t *const dir, const char *const file_name);
+
+/*
+ * \fn ssize_t read_group_file(char *buf, const size_t size, group_dir_t *dir, const group_file_t file)
+ * \brief Перечитывает часто используемый файл cgroup через pread(2), не открывая его заново.
+ * \param char *buf: Буфер, в который помещается содержимое, всегда завершается '\0'.
+ * \param const size_t size: Размер буфера.
+ * \param group_dir_t *dir: Каталог cgroup.
+ * \param const group_file_t file: Файл.
+ * \return Длина содержимого; 0 если файла нет (контроллер не смонтирован); -1 в случае ошибки.
+ */
+ssize_t read_group_file(char *buf, const size_t size, group_dir_t *dir, const group_file_t file);
+
+/*
+ * \fn int write_num(const uint64_t value, const group_dir_t *const dir, const char *const file_name)
+ * \brief Записывает целочисленное значение в файл cgroup.
+ * \param const uint64_t value: Записываемое значение.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \return 1 в случае ошибок; 0 если значение записано успешно.
+ */
+int write_num(const uint64_t value, const group_dir_t *const dir, const char *const file_name);
+
+/*
+ * \fn int write_str(const char *const value, const group_dir_t *const dir, const char *const file_name)
+ * \brief Записывает строку в файл cgroup.
+ * \param const char *const value: Записываемая строка.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \return 1 в случае ошибок; 0 если значение записано успешно.
+ */
+int write_str(const char *const value, const group_dir_t *const dir, const char *const file_name);
+
+/*
+ * \fn int write_num_all(const uint64_t value, const group_dir_t *const dir, const char *const file_name)
+ * \brief Записывает целочисленное значение в файл cgroup во всех иерархиях, основную - последней.
+ * \param const uint64_t value: Записываемое значение.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \return 1 в случае ошибок; 0 если значение записано успешно.
+ */
+int write_num_all(const uint64_t value, const group_dir_t *const dir, const char *const file_name);
+
+/*
+ * \fn int update_num(const uint64_t value, const group_dir_t *const dir, const char *const file_name)
+ * \brief Записывает целочисленное значение ограничения в файл cgroup.
+ * \param const uint64_t value: Записываемое значение.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \return 1 в случае ошибок; 0 если значение записано успешно или уже было таким.
+ * \note Для переиспользуемой cgroup сначала читает текущее значение и не пишет совпадающее.
+ */
+int update_num(const uint64_t value, const group_dir_t *const dir, const char *const file_name);
+
+/*
+ * \fn int update_str(const char *const value, const group_dir_t *const dir, const char *const file_name)
+ * \brief Записывает строковое значение ограничения в файл cgroup.
+ * \param const char *const value: Записываемая строка.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const char *const file_name: Название файла.
+ * \return 1 в случае ошибок; 0 если значение записано успешно или уже было таким.
+ * \note Для переиспользуемой cgroup сначала читает текущее значение и не пишет совпадающее.
+ */
+int update_str(const char *const value, const group_dir_t *const dir, const char *const file_name);
+
+/*
+ * \fn void copy_raw_content(const group_dir_t *const src_dir, const group_dir_t *const dst_dir, const char *const file_name)
+ * \brief Копирует содержимое файла.
+ * \param const group_dir_t *const src_dir: Каталог с исходным файлом (откуда копируем).
+ * \param const group_dir_t *const dst_dir: Каталог с файлом назначения (куда копируем).
+ * \param const char *const file_name: Название файла;
+ * \note В переиспользуемую cgroup совпадающее содержимое не записывается.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+void copy_raw_content(const group_dir_t *const src_dir, const group_dir_t *const dst_dir, const char *const file_name);
+
+#endif /* SRC_GROUP_H_ */
@@ -1,8 +1,235 @@
 // This is a personal academic project. Dear PVS-Studio, please check it.
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "conf.h"
 #include "log.h"
 
+// буфер записей для stderr и файла, байт
+#define LOG_BUF_SIZE (65536u)
+
+// максимальная длина одной записи, байт
+#define LOG_LINE_SIZE (1024u)
+
+// максимальное количество различных записей, которые считаются за операцию
+#define MAX_LOG_SITES (64u)
+
+typedef enum
+{
+    LOG_FORMAT_TEXT = 0, // "func: message", как и раньше
+    LOG_FORMAT_KV, // level=... func=... msg="..."
+    LOG_FORMAT_JSON // {"level":...,"func":...,"msg":...}
+} log_format_t;
+
+/*
+ * Место в коде, откуда пишутся записи. Узнаём его по адресу строки формата: у записи
+ * в цикле он один и тот же, сколько бы раз она ни писалась.
+ */
+typedef struct
+{
+    const char *fmt; // формат записи
+    const char *func; // функция, из которой пишется запись
+    int level; // уровень syslog
+    size_t count; // записей за текущую операцию
+} log_site_t;
+
+static int log_fd = -1; // куда пишем записи; -1 - в syslog
+static bool own_fd = false; // файл открыт нами и закрывается в log_close()
+static log_format_t log_format = LOG_FORMAT_TEXT;
+static int max_level = LOG_INFO;
+static const char *log_name = "";
+
+static char log_buf[LOG_BUF_SIZE]; // записи, ещё не записанные в log_fd
+static size_t log_buf_len = 0;
+
+static log_site_t sites[MAX_LOG_SITES];
+static size_t sites_count = 0;
+
+// clang-format off
+static const char *const level_names[] = {
+    [LOG_EMERG] = "emerg",
+    [LOG_ALERT] = "alert",
+    [LOG_CRIT] = "crit",
+    [LOG_ERR] = "err",
+    [LOG_WARNING] = "warning",
+    [LOG_NOTICE] = "notice",
+    [LOG_INFO] = "info",
+    [LOG_DEBUG] = "debug"
+};
+// clang-format on
+
+/*
+ * \fn void flush_buffer(void)
+ * \brief Записывает накопленные записи в log_fd одним вызовом write(2).
+ * \note Ошибки записи игнорируются: сообщить о них всё равно некуда.
+ */
+static void flush_buffer(void)
+{
+    size_t written = 0;
+
+    while (written < log_buf_len) {
+        const ssize_t ret = write(log_fd, log_buf + written, log_buf_len - written);
+
+        if (ret == -1 && errno == EINTR)
+            continue;
+
+        if (ret <= 0)
+            break;
+
+        written += ret;
+    }
+
+    log_buf_len = 0;
+}
+
+/*
+ * \fn void append(char *line, const size_t size, size_t *len, const char *const fmt, ...)
+ * \brief Дописывает в запись форматированную строку, обрезая её по размеру буфера.
+ * \param char *line: Буфер записи.
+ * \param const size_t size: Размер буфера.
+ * \param size_t *len: Текущая длина записи, увеличивается на длину строки.
+ * \param const char *const fmt: Формат строки.
+ */
+static void __attribute__((format(printf, 4, 5))) append(char *line, const size_t size, size_t *len, const char *const fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    const int ret = vsnprintf(line + *len, size - *len, fmt, args);
+    va_end(args);
+
+    if (ret > 0)
+        *len = ((*len + ret < size) ? *len + ret : size - 1);
+}
+
+/*
+ * \fn void append_escaped(char *line, const size_t size, size_t *len, const char *const value)
+ * \brief Дописывает в запись строку в кавычках, экранируя её как в JSON.
+ * \param char *line: Буфер записи.
+ * \param const size_t size: Размер буфера.
+ * \param size_t *len: Текущая длина записи, увеличивается на длину строки.
+ * \param const char *const value: Строка.
+ */
+static void append_escaped(char *line, const size_t size, size_t *len, const char *const value)
+{
+    append(line, size, len, "\"");
+
+    for (const unsigned char *p = (const unsigned char *) value; *p != '\0'; p++)
+        if (*p == '"' || *p == '\\')
+            append(line, size, len, "\\%c", *p);
+        else if (*p == '\n')
+            append(line, size, len, "\\n");
+        else if (*p < 0x20)
+            append(line, size, len, "\\u%04x", *p);
+        else
+            append(line, size, len, "%c", *p);
+
+    append(line, size, len, "\"");
+}
+
+/*
+ * \fn void emit(const int level, const char *const func, const char *const msg)
+ * \brief Форматирует запись и отправляет её в syslog или в буфер.
+ * \param const int level: Уровень syslog.
+ * \param const char *const func: Функция, из которой пишется запись.
+ * \param const char *const msg: Сообщение.
+ */
+static void emit(const int level, const char *const func, const char *const msg)
+{
+    char line[LOG_LINE_SIZE];
+    char ts[40];
+    size_t len = 0;
+
+    // Время, название программы и pid в syslog добавляет сам syslog.
+
+    if (log_fd != -1) {
+        struct timespec now;
+        struct tm tm;
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        gmtime_r(&now.tv_sec, &tm);
+
+        const size_t ts_len = strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+
+        snprintf(ts + ts_len, sizeof(ts) - ts_len, ".%06ldZ", now.tv_nsec / 1000);
+    }
+
+    switch (log_format) {
+        case LOG_FORMAT_TEXT:
+            if (log_fd != -1)
+                append(line, sizeof(line), &len, "%s %s[%d]: ", ts, log_name, getpid());
+
+            append(line, sizeof(line), &len, "%s: %s", func, msg);
+            break;
+
+        case LOG_FORMAT_KV:
+            if (log_fd != -1)
+                append(line, sizeof(line), &len, "ts=%s prog=%s pid=%d ", ts, log_name, getpid());
+
+            append(line, sizeof(line), &len, "level=%s func=%s msg=", level_names[level], func);
+            append_escaped(line, sizeof(line), &len, msg);
+            break;
+
+        case LOG_FORMAT_JSON:
+            append(line, sizeof(line), &len, "{");
+
+            if (log_fd != -1)
+                append(line, sizeof(line), &len, "\"ts\":\"%s\",\"prog\":\"%s\",\"pid\":%d,", ts, log_name, getpid());
+
+            append(line, sizeof(line), &len, "\"level\":\"%s\",\"func\":\"%s\",\"msg\":", level_names[level], func);
+            append_escaped(line, sizeof(line), &len, msg);
+            append(line, sizeof(line), &len, "}");
+            break;
+    }
+
+    if (log_fd == -1) {
+        syslog(level, "%s", line);
+        return;
+    }
+
+    // WARN: Перевод строки пишем в обход append(): обрезанная запись тоже должна им заканчиваться.
+    line[len++] = '\n';
+
+    if (log_buf_len + len > sizeof(log_buf))
+        flush_buffer();
+
+    memcpy(log_buf + log_buf_len, line, len);
+    log_buf_len += len;
+
+    // Ошибки пишем сразу: за ними может последовать abort(), и буфер пропадёт.
+    if (level <= LOG_ERR)
+        flush_buffer();
+}
+
+/*
+ * \fn bool is_allowed(const int level, const char *const func, const char *const fmt)
+ * \brief Считает запись и проверяет, не превышен ли лимит одинаковых записей за операцию.
+ * \param const int level: Уровень syslog.
+ * \param const char *const func: Функция, из которой пишется запись.
+ * \param const char *const fmt: Формат записи.
+ * \return true - если запись нужно написать; false - если только посчитать.
+ */
+static bool is_allowed(const int level, const char *const func, const char *const fmt)
+{
+    for (size_t i = 0; i < sites_count; i++)
+        if (sites[i].fmt == fmt)
+            return (++sites[i].count <= LOG_BURST);
+
+    // Если мест в коде оказалось больше, чем таблица, то новые записи просто не ограничиваем.
+    if (sites_count < MAX_LOG_SITES)
+        sites[sites_count++] = (log_site_t) { .fmt = fmt, .func = func, .level = level, .count = 1 };
+
+    return true;
+}
+
 /*
  * \fn void log_open(const char *const prog_name, const bool debug)
  * \brief Открывает syslog и настраивает уровень логирования.
@@ -11,11 +238,17 @@
  */
 void log_open(const char *const prog_name, const bool debug)
 {
-    openlog(prog_name, LOG_PID, LOG_USER);
+    static bool registered = false;
 
-    const int level = ((debug) ? LOG_DEBUG : LOG_INFO);
+    log_name = prog_name;
+    max_level = ((debug) ? LOG_DEBUG : LOG_INFO);
 
-    setlogmask(LOG_UPTO(level));
+    if (log_fd == -1)
+        openlog(prog_name, LOG_PID, LOG_USER);
+
+    // Утилиты завершаются и через exit(3) (например, из errx(3)), не оставляем записи в буфере.
+    if (!registered && atexit(log_flush) == 0)
+        registered = true;
 }
 
 /*
@@ -24,5 +257,110 @@ void log_open(const char *const prog_name, const bool debug)
  */
 void log_close(void)
 {
-    closelog();
+    log_flush();
+
+    if (log_fd == -1) {
+        closelog();
+        return;
+    }
+
+    if (own_fd) {
+        close(log_fd);
+        own_fd = false;
+
+        // Случайные записи после закрытия файла пусть лучше попадут в stderr, чем в syslog.
+        log_fd = STDERR_FILENO;
+    }
+}
+
+int log_set_target(const char *const target)
+{
+    int fd = -1;
+
+    if (strcmp(target, "stderr") == 0)
+        fd = STDERR_FILENO;
+    else if (strcmp(target, "syslog") != 0) {
+        fd = open(target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+        if (fd == -1)
+            return 1;
+    }
+
+    if (own_fd)
+        close(log_fd);
+
+    log_fd = fd;
+    own_fd = (fd > STDERR_FILENO);
+
+    return 0;
+}
+
+int log_set_format(const char *const format)
+{
+    if (strcmp(format, "text") == 0)
+        log_format = LOG_FORMAT_TEXT;
+    else if (strcmp(format, "kv") == 0)
+        log_format = LOG_FORMAT_KV;
+    else if (strcmp(format, "json") == 0)
+        log_format = LOG_FORMAT_JSON;
+    else
+        return 1;
+
+    return 0;
+}
+
+void log_write(const int level, const char *const func, const char *const fmt, ...)
+{
+    char msg[LOG_LINE_SIZE];
+    va_list args;
+
+    // Отладочные записи без --debug отбрасываем раньше всего, ещё до форматирования.
+    if (level > max_level)
+        return;
+
+    const int saved_errno = errno;
+
+    // За критической ошибкой следует abort(), поэтому перед ней выводим всё накопленное.
+    if (level <= LOG_CRIT)
+        log_flush();
+
+    // Ошибки не подавляем никогда: ограничиваются только информационные и отладочные записи.
+    if (level > LOG_ERR && !is_allowed(level, func, fmt)) {
+        errno = saved_errno;
+        return;
+    }
+
+    va_start(args, fmt);
+    errno = saved_errno; // для '%m'
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+
+    emit(level, func, msg);
+
+    errno = saved_errno;
+}
+
+void log_flush(void)
+{
+    char msg[LOG_LINE_SIZE];
+
+    const int saved_errno = errno;
+
+    for (size_t i = 0; i < sites_count; i++) {
+        const log_site_t *const site = &sites[i];
+
+        if (site->count <= LOG_BURST)
+            continue;
+
+        snprintf(msg, sizeof(msg), "%zu more similar records suppressed: '%s'", site->count - LOG_BURST, site->fmt);
+
+        emit(site->level, site->func, msg);
+    }
+
+    sites_count = 0;
+
+    if (log_fd != -1)
+        flush_buffer();
+
+    errno = saved_errno;
 }
@@ -4,11 +4,48 @@
 #include <stdbool.h>
 #include <syslog.h>
 
-#define LOG_E(fmt, ...) syslog(LOG_ERR, "%s: " fmt, __FUNCTION__, ##__VA_ARGS__)
-#define LOG_C(fmt, ...) syslog(LOG_CRIT, "%s: " fmt, __FUNCTION__, ##__VA_ARGS__)
-#define LOG_D(fmt, ...) syslog(LOG_DEBUG, "%s: " fmt, __FUNCTION__, ##__VA_ARGS__)
+#define LOG_E(fmt, ...) log_write(LOG_ERR, __FUNCTION__, fmt, ##__VA_ARGS__)
+#define LOG_C(fmt, ...) log_write(LOG_CRIT, __FUNCTION__, fmt, ##__VA_ARGS__)
+#define LOG_I(fmt, ...) log_write(LOG_INFO, __FUNCTION__, fmt, ##__VA_ARGS__)
+#define LOG_D(fmt, ...) log_write(LOG_DEBUG, __FUNCTION__, fmt, ##__VA_ARGS__)
 
 void log_open(const char *const prog_name, const bool debug);
 void log_close(void);
 
+/*
+ * \fn int log_set_target(const char *const target)
+ * \brief Задаёт, куда писать записи: syslog (по-умолчанию), stderr или файл.
+ * \param const char *const target: "syslog", "stderr" или путь к файлу, который дописывается.
+ * \return 1 в случае ошибки открытия файла (errno сохраняется); 0 если всё хорошо.
+ * \note Вызывается до log_open().
+ */
+int log_set_target(const char *const target);
+
+/*
+ * \fn int log_set_format(const char *const format)
+ * \brief Задаёт формат записей: "text" (по-умолчанию), "kv" (key=value) или "json".
+ * \param const char *const format: Название формата.
+ * \return 1 если формат неизвестен; 0 если всё хорошо.
+ */
+int log_set_format(const char *const format);
+
+/*
+ * \fn void log_write(const int level, const char *const func, const char *const fmt, ...)
+ * \brief Пишет запись в лог, используется через макросы LOG_*.
+ * \param const int level: Уровень syslog.
+ * \param const char *const func: Функция, из которой пишется запись.
+ * \param const char *const fmt: Формат сообщения, как у printf(3), включая '%m'.
+ * \note Одинаковые (с одним и тем же fmt) записи ниже LOG_ERR сверх LOG_BURST за операцию не пишутся,
+ *       а считаются, и при log_flush() вместо них пишется одна запись с их количеством.
+ *       В stderr и файл записи копятся в буфере, ошибки сбрасывают его сразу. errno сохраняется.
+ */
+void log_write(const int level, const char *const func, const char *const fmt, ...) __attribute__((format(printf, 3, 4)));
+
+/*
+ * \fn void log_flush(void)
+ * \brief Завершает операцию: пишет количество подавленных записей и сбрасывает буфер.
+ * \note Вызывается и перед fork(2), иначе дочерний процесс унаследует и продублирует буфер.
+ */
+void log_flush(void);
+
 #endif /* LOG_H_ */
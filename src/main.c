@@ -14,7 +14,10 @@
 
 #include "conf.h"
 #include "cgroup.h"
+#include "freezer.h"
 #include "log.h"
+#include "tasks.h"
+#include "timings.h"
 #include "utils.h"
 
 #define PROG_NAME ("cgctl")
@@ -22,9 +25,12 @@
 typedef struct
 {
     bool debug; // режим отладки включен/выключен
-    unsigned int cpu_usage; // ограничение по CPU, в процентах
-    unsigned int mem_usage; // ограничение по памяти, в процентах
+    bool subreaper; // подбирать осиротевших потомков вместо init
+    cgroup_limits_t limits; // ограничения cgroup
+    unsigned int grace_ms; // время на мягкую остановку, миллисекунд
+    int stop_signal; // сигнал мягкой остановки
     char *group; // название cgroup
+    bool timings; // выводить время фаз в stderr
 } options_t;
 
 static void show_usage(void)
@@ -34,11 +40,28 @@ static void show_usage(void)
         "Usage: %s [--help] [--options=OPTIONS] SCRIPT ACTION\n"
         "\t--help: show this help;\n"
         "\t--options=OPTIONS: set custom options;\n"
-        "\tOPTIONS: debug,group=NAME,cpu_usage=NUM,mem_usage=NUM\n"
+        "\tOPTIONS: debug,subreaper,group=NAME,cpu_usage=NUM,mem_usage=NUM,mem_high=SIZE,cpu_quota=NUM,cpu_period=US,cpus=LIST,numa_node=NODE,memory_migrate,io_weight=NUM,io_max=LIMITS,max_tasks=NUM,freeze_timeout=MS,timeout=MS,grace=MS,signal=SIG,timings,log=TARGET,log_format=FORMAT\n"
         "\t\tdebug: enable debug mode;\n"
+        "\t\tsubreaper: reap orphaned descendants of the script instead of init;\n"
         "\t\tgroup=NAME: use group name (same as script by default);\n"
         "\t\tcpu_usage=NUM: set maximum CPU usage, percent (100%% by default);\n"
         "\t\tmem_usage=NUM: set maximum memory usage, percent (100%% by default);\n"
+        "\t\tmem_high=SIZE: reclaim memory above SIZE before the maximum, NUM%% of RAM or bytes with K/M/G suffix (disabled by default);\n"
+        "\t\tcpu_quota=NUM: set hard CPU limit, NUM%% of all cores or cores count, e.g. 1.5 (no limit by default);\n"
+        "\t\tcpu_period=US: set CPU quota period, microseconds (100000 by default);\n"
+        "\t\tcpus=LIST: run only on these CPUs, ':' separated, e.g. 0-3:8 (all CPUs by default);\n"
+        "\t\tnuma_node=NODE: run on CPUs and allocate memory of NUMA node NODE, or the least loaded one if 'auto';\n"
+        "\t\tmemory_migrate: move memory of the tasks when the NUMA node changes;\n"
+        "\t\tio_weight=NUM: set relative I/O weight, 1..10000 (100 by default);\n"
+        "\t\tio_max=LIMITS: limit I/O of a disk, ':' separated, e.g. sda:rbps=10M:wiops=100, may be repeated (no limit by default);\n"
+        "\t\tmax_tasks=NUM: set maximum number of tasks (processes and threads) in the group (no limit by default);\n"
+        "\t\tfreeze_timeout=MS: wait for freezing the group up to MS milliseconds (2000 by default);\n"
+        "\t\ttimeout=MS: wait for removing the group up to MS milliseconds (5000 by default);\n"
+        "\t\tgrace=MS: on stop send SIG to all tasks and wait up to MS milliseconds before killing them (disabled by default);\n"
+        "\t\tsignal=SIG: signal for graceful stop (TERM by default);\n"
+        "\t\ttimings: print durations of the group creation/removal phases as a JSON line to stderr;\n"
+        "\t\tlog=TARGET: write log to syslog, stderr or a file (syslog by default);\n"
+        "\t\tlog_format=FORMAT: log format, text, kv (key=value) or json (text by default);\n"
         "\tSCRIPT: initscript to run;\n"
         "\tACTION: initscript action (start|stop|restart|etc);\n"
         "WARNING! DO NOT PUT space between '--options' and OPTIONS, use '=' only!!!\n"
@@ -85,17 +108,51 @@ static int parse_options(char *opts_value, options_t *opts)
     enum
     {
         DEBUG_OPT = 0,
+        SUBREAPER_OPT,
         GROUP_OPT,
         CPU_USAGE_OPT,
-        MEM_USAGE_OPT
+        MEM_USAGE_OPT,
+        MEM_HIGH_OPT,
+        CPU_QUOTA_OPT,
+        CPU_PERIOD_OPT,
+        CPUS_OPT,
+        NUMA_NODE_OPT,
+        MEMORY_MIGRATE_OPT,
+        IO_WEIGHT_OPT,
+        IO_MAX_OPT,
+        MAX_TASKS_OPT,
+        FREEZE_TIMEOUT_OPT,
+        TIMEOUT_OPT,
+        GRACE_OPT,
+        SIGNAL_OPT,
+        TIMINGS_OPT,
+        LOG_OPT,
+        LOG_FORMAT_OPT
     };
 
     // clang-format off
     char *const names[] = {
         [DEBUG_OPT] = "debug",
+        [SUBREAPER_OPT] = "subreaper",
         [GROUP_OPT] = "group",
         [CPU_USAGE_OPT] = "cpu_usage",
         [MEM_USAGE_OPT] = "mem_usage",
+        [MEM_HIGH_OPT] = "mem_high",
+        [CPU_QUOTA_OPT] = "cpu_quota",
+        [CPU_PERIOD_OPT] = "cpu_period",
+        [CPUS_OPT] = "cpus",
+        [NUMA_NODE_OPT] = "numa_node",
+        [MEMORY_MIGRATE_OPT] = "memory_migrate",
+        [IO_WEIGHT_OPT] = "io_weight",
+        [IO_MAX_OPT] = "io_max",
+        [MAX_TASKS_OPT] = "max_tasks",
+        [FREEZE_TIMEOUT_OPT] = "freeze_timeout",
+        [TIMEOUT_OPT] = "timeout",
+        [GRACE_OPT] = "grace",
+        [SIGNAL_OPT] = "signal",
+        [TIMINGS_OPT] = "timings",
+        [LOG_OPT] = "log",
+        [LOG_FORMAT_OPT] = "log_format",
         NULL
     };
     // clang-format on
@@ -119,6 +176,14 @@ static int parse_options(char *opts_value, options_t *opts)
                 opts->debug = true;
                 continue;
 
+            case SUBREAPER_OPT:
+                opts->subreaper = true;
+                continue;
+
+            case TIMINGS_OPT:
+                opts->timings = true;
+                continue;
+
             case GROUP_OPT:
                 if (value != NULL) {
                     opts->group = value;
@@ -128,14 +193,122 @@ static int parse_options(char *opts_value, options_t *opts)
 
             case CPU_USAGE_OPT:
                 if (value != NULL) {
-                    opts->cpu_usage = get_cpu_usage(value);
+                    opts->limits.cpu_usage = get_cpu_usage(value);
                     continue;
                 }
                 break;
 
             case MEM_USAGE_OPT:
                 if (value != NULL) {
-                    opts->mem_usage = get_mem_usage(value);
+                    opts->limits.mem_usage = get_mem_usage(value);
+                    continue;
+                }
+                break;
+
+            case MEM_HIGH_OPT:
+                if (value != NULL) {
+                    opts->limits.mem_high = get_mem_size(value);
+                    continue;
+                }
+                break;
+
+            case CPU_QUOTA_OPT:
+                if (value != NULL) {
+                    opts->limits.cpu_quota = get_cpu_quota(value);
+                    continue;
+                }
+                break;
+
+            case CPU_PERIOD_OPT:
+                if (value != NULL) {
+                    opts->limits.cpu_period_us = get_cpu_period(value);
+                    continue;
+                }
+                break;
+
+            case CPUS_OPT:
+                if (value != NULL) {
+                    opts->limits.cpus = get_cpu_list(value);
+                    continue;
+                }
+                break;
+
+            case NUMA_NODE_OPT:
+                if (value != NULL) {
+                    opts->limits.numa_node = get_numa_node(value);
+                    continue;
+                }
+                break;
+
+            case MEMORY_MIGRATE_OPT:
+                opts->limits.memory_migrate = true;
+                continue;
+
+            case IO_WEIGHT_OPT:
+                if (value != NULL) {
+                    opts->limits.io_weight = get_io_weight(value);
+                    continue;
+                }
+                break;
+
+            case IO_MAX_OPT:
+                if (value != NULL) {
+                    get_io_max(value, &opts->limits);
+                    continue;
+                }
+                break;
+
+            case MAX_TASKS_OPT:
+                if (value != NULL) {
+                    opts->limits.max_tasks = get_max_tasks(value);
+                    continue;
+                }
+                break;
+
+            case FREEZE_TIMEOUT_OPT:
+                if (value != NULL) {
+                    freezer_set_timeout(get_timeout(value));
+                    continue;
+                }
+                break;
+
+            case TIMEOUT_OPT:
+                if (value != NULL) {
+                    cgroup_set_destroy_timeout(get_timeout(value));
+                    continue;
+                }
+                break;
+
+            case GRACE_OPT:
+                if (value != NULL) {
+                    opts->grace_ms = get_timeout(value);
+                    continue;
+                }
+                break;
+
+            case SIGNAL_OPT:
+                if (value != NULL) {
+                    opts->stop_signal = get_signal(value);
+                    continue;
+                }
+                break;
+
+            case LOG_OPT:
+                if (value != NULL) {
+                    if (log_set_target(value) != 0) {
+                        fprintf(stderr, "Error: Unable to open log file '%s', error '%m'.\n", value);
+                        return 1;
+                    }
+                    continue;
+                }
+                break;
+
+            case LOG_FORMAT_OPT:
+                if (value != NULL) {
+                    if (log_set_format(value) != 0) {
+                        fprintf(stderr, "Error: Unknown log format '%s'.\n", value);
+                        return 1;
+                    }
                     continue;
                 }
                 break;
@@ -153,17 +326,39 @@ static int parse_options(char *opts_value, options_t *opts)
 }
 
 /*
- * \fn int run_process(char **argv)
+ * \fn void child_fail(const char *const reason, const char *const script)
+ * \brief Сообщает об ошибке в дочернем процессе до execv(2) и завершает его с кодом 127.
+ * \param const char *const reason: Описание ошибки.
+ * \param const char *const script: init-скрипт.
+ * \note Пишет только через write(2): после clone3(2) stdio, syslog и abort() небезопасны.
+ */
+static void __attribute__((noreturn)) child_fail(const char *const reason, const char *const script)
+{
+    const char *const parts[] = { "Error: ", reason, " '", script, "'.\n" };
+
+    for (size_t i = 0; i < sizeof(parts) / sizeof(*parts); i++)
+        if (write(STDERR_FILENO, parts[i], strlen(parts[i])) == -1)
+            break;
+
+    _exit(127);
+}
+
+/*
+ * \fn int run_process(char *const script, char *const action, const char *const group)
  * \brief Запускает init-скрипт в bash и дожидается его завершения.
  * \param char *const script: init-скрипт.
  * \param char *const action: Аргумент скрипта, действие (start|stop|etc).
+ * \param const char *const group: cgroup, в которой запускается скрипт; NULL - в текущей.
  * \return Код выхода запущенного init-скрипта.
  */
-static int run_process(char *const script, char *const action)
+static int run_process(char *const script, char *const action, const char *const group)
 {
     LOG_D("Exec init-script '%s' with action '%s'.", script, action);
 
-    const pid_t child_pid = fork();
+    log_flush(); // WARN: Иначе буфер лога продублирует дочерний процесс.
+
+    // Сам cgctl в cgroup не переносим: скрипт сразу рождается в ней.
+    const pid_t child_pid = ((group == NULL) ? fork() : cgroup_fork(group));
 
     if (child_pid == -1) {
         LOG_C("Unable to fork() process, error '%m'.");
@@ -171,30 +366,45 @@ static int run_process(char *const script, char *const action)
     }
 
     if (child_pid == 0) {
-        if (prctl(PR_SET_PDEATHSIG, SIGKILL) == -1) {
-            LOG_C("Unable to set PR_SET_PDEATHSIG, error '%m'.");
-            abort();
-        }
+        // WARN: До execv(2) в дочернем процессе допустимы только async-signal-safe
+        // функции (см. fork_into_group()): никаких LOG_*, stdio и abort().
 
-        log_close(); // WARN: Обязательно закрываем syslog в дочернем процессе!
+        if (prctl(PR_SET_PDEATHSIG, SIGKILL) == -1)
+            child_fail("Unable to set PR_SET_PDEATHSIG for init-script", script);
+
+        // Сокет syslog и файл лога открыты с close-on-exec и закроются при execv(2) сами,
+        // а буфер лога сброшен перед fork'ом.
 
         char *argv[] = { SHELL, script, action, NULL };
 
-        if (execv(argv[0], argv) == -1) {
-            if (errno == ENOENT)
-                fprintf(stderr, "Error: Unable to find init-script '%s'.\n", script);
-            else
-                fprintf(stderr, "Unable to run init-script '%s' with action '%s', error '%m'.\n", script, action);
-        }
+        execv(argv[0], argv);
 
-        abort(); // WARN: По-идее этот код никогда не должен выполниться.
+        child_fail(((errno == ENOENT) ? "Unable to find init-script" : "Unable to run init-script"), script);
     }
 
     int status = 1;
 
-    if (waitpid(child_pid, &status, 0) == -1) {
-        LOG_C("Unable to wait for pid %u, error '%m'.", child_pid);
-        abort();
+    /*
+     * В режиме subreaper осиротевшие потомки скрипта (например, после двойного fork'а
+     * демона) переходят к нам, а не к init. Подбираем их сразу же по завершении,
+     * чтобы зомби не задерживали удаление cgroup.
+     */
+
+    for (;;) {
+        const pid_t pid = waitpid(-1, &status, 0);
+
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+
+            LOG_C("Unable to wait for pid %u, error '%m'.", child_pid);
+            abort();
+        }
+
+        if (pid == child_pid)
+            break;
+
+        LOG_D("Orphaned process %u has been reaped.", pid);
     }
 
     const int exit_code = WEXITSTATUS(status);
@@ -212,9 +422,11 @@ int main(int argc, char **argv)
     // Значения по-умолчанию.
     options_t opts = {
         .debug = false,
-        .cpu_usage = 100,
-        .mem_usage = 100,
-        .group = NULL
+        .subreaper = false,
+        .grace_ms = 0,
+        .stop_signal = SIGTERM,
+        .group = NULL,
+        .timings = false
     };
 
     static struct option long_opts[] = {
@@ -225,6 +437,8 @@ int main(int argc, char **argv)
 
     *group = '\0';
 
+    cgroup_limits_init(&opts.limits);
+
     while ((opt = getopt_long(argc, argv, "ho:", long_opts, 0)) != -1)
         switch (opt) {
             case 'h':
@@ -279,42 +493,71 @@ int main(int argc, char **argv)
         }
     }
 
-    const unsigned int cpu_usage = opts.cpu_usage;
-    const unsigned int mem_usage = opts.mem_usage;
+    const cgroup_limits_t *const limits = &opts.limits;
+
+    cgroup_set_graceful_stop(opts.stop_signal, opts.grace_ms);
 
     log_open(PROG_NAME, opts.debug);
 
-    LOG_D("Started with script='%s', action='%s' in group='%s', cpu_usage=%u, mem_usage=%u.",
-        script, action, group, cpu_usage, mem_usage);
+    LOG_D("Started with script='%s', action='%s' in group='%s', cpu_usage=%u, mem_usage=%u, cpu_quota=%u/1000.",
+        script, action, group, limits->cpu_usage, limits->mem_usage, limits->cpu_quota);
+
+    if (opts.subreaper)
+        cgroup_set_subreaper();
 
     int exit_code = 1;
 
     if (strcmp(action, "start") == 0) {
         // По команде на запуск создаём cgroup, затем запускаем init-скрипт.
-        cgroup_create(group, cpu_usage, mem_usage);
-        exit_code = run_process(script, action);
+        timings_init(opts.timings);
+        cgroup_create(group, limits);
+        timings_report(action, group, EXIT_SUCCESS);
+        exit_code = run_process(script, action, group);
 
     } else if (strcmp(action, "stop") == 0) {
         // По команде на остановку останавливаем init-скрипт, затем удаляем cgroup.
-        exit_code = run_process(script, action);
-        cgroup_destroy(group);
+        exit_code = run_process(script, action, NULL);
+
+        timings_init(opts.timings);
+
+        const int destroy_code = cgroup_destroy(group);
+
+        timings_report(action, group, destroy_code);
+
+        if (destroy_code != 0 && exit_code == 0)
+            exit_code = 1; // WARN: Оставшиеся процессы - тоже ошибка остановки.
 
     } else if (strcmp(action, "restart") == 0) {
         // WARN: По команде на перезапуск выполняем сначала stop, затем start;
         // вызывать init-скрипт c restart нельзя т.к. в нём restart может быть
         // реализован очень странными методами.
 
-        run_process(script, "stop"); // WARN: Игнорируем код выхода!
-        cgroup_destroy(group);
+        run_process(script, "stop", NULL); // WARN: Игнорируем код выхода!
+
+        // Саму cgroup не пересоздаём: опустошаем её и переиспользуем, обновив
+        // только изменившиеся ограничения. Так не нужны ни rmdir, ни mkdir.
+
+        timings_init(opts.timings);
 
-        cgroup_create(group, cpu_usage, mem_usage);
-        exit_code = run_process(script, "start");
+        if (cgroup_drain(group) != 0) {
+            LOG_E("Unable to drain group '%s', unable to restart.", group);
+            timings_report(action, group, EXIT_FAILURE);
+            log_close();
+            return EXIT_FAILURE;
+        }
+
+        cgroup_reuse(group, limits);
+        timings_report(action, group, EXIT_SUCCESS);
+        exit_code = run_process(script, "start", group);
 
     } else {
         // По любой другой команде просто выполняем её.
-        exit_code = run_process(script, action);
+        exit_code = run_process(script, action, NULL);
     }
 
+    if (opts.subreaper)
+        reap_children();
+
     LOG_D("Script '%s' with action '%s' exited with code %d.", script, action, exit_code);
 
     log_close();
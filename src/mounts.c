@@ -0,0 +1,401 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "conf.h"
+#include "log.h"
+#include "mounts.h"
+
+// длина идентификатора загрузки: UUID в текстовом виде
+#define BOOT_ID_SIZE (36)
+
+// clang-format off
+static const char *const controller_names[CONTROLLERS_COUNT] = {
+    [CONTROLLER_FREEZER] = "freezer",
+    [CONTROLLER_CPU] = "cpu",
+    [CONTROLLER_CPUSET] = "cpuset",
+    [CONTROLLER_MEMORY] = "memory",
+    [CONTROLLER_BLKIO] = "blkio",
+    [CONTROLLER_PIDS] = "pids",
+    [CONTROLLER_CPUACCT] = "cpuacct"
+};
+// clang-format on
+
+/*
+ * Точки монтирования контроллеров до объединения в иерархии: в таком виде
+ * они и разбираются из MOUNTINFO_FILE, и хранятся в кэше.
+ */
+typedef struct
+{
+    unsigned int version; // версия cgroup: 1 или 2
+    char paths[CONTROLLERS_COUNT][MAX_FILE_PATH]; // точка монтирования контроллера; пустая строка - не смонтирован
+} controllers_t;
+
+static cgroup_mounts_t mounts = { .count = 0 };
+
+/*
+ * \fn void unescape_path(char *path)
+ * \brief Раскодирует путь из MOUNTINFO_FILE, где пробелы и т.п. записаны как "\040".
+ * \param char *path: Путь, раскодируется на месте.
+ */
+static void unescape_path(char *path)
+{
+    char *out = path;
+
+    for (const char *in = path; *in != '\0'; in++, out++) {
+        if (in[0] == '\\' && in[1] >= '0' && in[1] <= '3' && in[2] >= '0' && in[2] <= '7' && in[3] >= '0' && in[3] <= '7') {
+            *out = (char) (((in[1] - '0') << 6) | ((in[2] - '0') << 3) | (in[3] - '0'));
+            in += 3;
+        } else
+            *out = *in;
+    }
+
+    *out = '\0';
+}
+
+/*
+ * \fn void set_path(char *path, const char *const mount_point)
+ * \brief Запоминает точку монтирования контроллера.
+ * \param char *path: Запомненная ранее точка монтирования или пустая строка.
+ * \param const char *const mount_point: Найденная точка монтирования.
+ * \note Одна иерархия может быть смонтирована в нескольких местах, тогда берём первую,
+ *       но CGROUP_ROOT_DIR предпочтительнее любой другой.
+ */
+static void set_path(char *path, const char *const mount_point)
+{
+    const size_t root_len = strlen(CGROUP_ROOT_DIR);
+
+    if (*path != '\0' && (strncmp(path, CGROUP_ROOT_DIR, root_len) == 0 || strncmp(mount_point, CGROUP_ROOT_DIR, root_len) != 0))
+        return;
+
+    if (snprintf(path, MAX_FILE_PATH, "%s", mount_point) >= MAX_FILE_PATH) {
+        LOG_C("Mount point '%s' is too long.", mount_point);
+        abort();
+    }
+}
+
+/*
+ * \fn bool parse_mountinfo(controllers_t *found)
+ * \brief Ищет точки монтирования контроллеров в MOUNTINFO_FILE.
+ * \param controllers_t *found: Найденные точки монтирования.
+ * \return true - если cgroup смонтированы; false - если нет.
+ */
+static bool parse_mountinfo(controllers_t *found)
+{
+    char *line = NULL;
+    size_t size = 0;
+    char unified[MAX_FILE_PATH] = "";
+
+    memset(found, 0, sizeof(*found));
+
+    FILE *const file = fopen(MOUNTINFO_FILE, "re");
+
+    if (file == NULL) {
+        LOG_C("Unable to open '%s', error '%m'.", MOUNTINFO_FILE);
+        abort();
+    }
+
+    // Формат строки: "36 25 0:31 / /sys/fs/cgroup/cpu,cpuacct rw,nosuid - cgroup cgroup rw,cpu,cpuacct".
+    // Необязательных полей перед " - " может быть сколько угодно, поэтому ищем разделитель.
+
+    while (getline(&line, &size, file) != -1) {
+        char mount_point[MAX_FILE_PATH];
+        char fs_type[16];
+        char options[256];
+        char *save;
+
+        const char *const sep = strstr(line, " - ");
+
+        if (sep == NULL || sscanf(line, "%*s %*s %*s %*s %255s", mount_point) != 1 || sscanf(sep + 3, "%15s %*s %255s", fs_type, options) != 2)
+            continue;
+
+        unescape_path(mount_point);
+
+        if (strcmp(fs_type, "cgroup2") == 0) {
+            set_path(unified, mount_point);
+            continue;
+        }
+
+        if (strcmp(fs_type, "cgroup") != 0)
+            continue;
+
+        // Контроллеры иерархии v1 перечислены в опциях суперблока.
+
+        for (char *option = strtok_r(options, ",", &save); option != NULL; option = strtok_r(NULL, ",", &save))
+            for (size_t i = 0; i < CONTROLLERS_COUNT; i++)
+                if (strcmp(option, controller_names[i]) == 0)
+                    set_path(found->paths[i], mount_point);
+    }
+
+    free(line);
+
+    if (fclose(file) == EOF) {
+        LOG_C("Unable to close '%s', error '%m'.", MOUNTINFO_FILE);
+        abort();
+    }
+
+    // WARN: В гибридном режиме systemd есть и unified-иерархия, но контроллеры смонтированы
+    // как v1, а в unified их нет. Поэтому v1 выбираем, если смонтирован хоть один основной.
+
+    if (*found->paths[CONTROLLER_FREEZER] != '\0' || *found->paths[CONTROLLER_CPU] != '\0' || *found->paths[CONTROLLER_MEMORY] != '\0') {
+        found->version = 1;
+        return true;
+    }
+
+    if (*unified == '\0')
+        return false;
+
+    found->version = 2;
+
+    for (size_t i = 0; i < CONTROLLERS_COUNT; i++)
+        memcpy(found->paths[i], unified, sizeof(unified));
+
+    return true;
+}
+
+/*
+ * \fn bool read_boot_id(char *boot_id)
+ * \brief Читает идентификатор текущей загрузки системы.
+ * \param char *boot_id: Буфер размером BOOT_ID_SIZE + 1.
+ * \return true - если прочитан; false - если нет.
+ */
+static bool read_boot_id(char *boot_id)
+{
+    FILE *const file = fopen(BOOT_ID_FILE, "re");
+
+    if (file == NULL) {
+        LOG_D("Unable to open '%s', error '%m'.", BOOT_ID_FILE);
+        return false;
+    }
+
+    const bool ok = (fgets(boot_id, BOOT_ID_SIZE + 1, file) != NULL && strlen(boot_id) == BOOT_ID_SIZE);
+
+    fclose(file);
+
+    return ok;
+}
+
+/*
+ * \fn bool load_cache(controllers_t *found, const char *const boot_id)
+ * \brief Читает точки монтирования контроллеров из кэша.
+ * \param controllers_t *found: Точки монтирования.
+ * \param const char *const boot_id: Идентификатор текущей загрузки.
+ * \return true - если кэш создан в текущую загрузку и прочитан; false - если нет.
+ */
+static bool load_cache(controllers_t *found, const char *const boot_id)
+{
+    char line[MAX_FILE_PATH + 32];
+    bool loaded = false;
+
+    memset(found, 0, sizeof(*found));
+
+    FILE *const file = fopen(MOUNTS_CACHE_FILE, "re");
+
+    if (file == NULL)
+        return false;
+
+    // Первая строка - идентификатор загрузки, вторая - версия, дальше "контроллер путь"
+    // для каждого контроллера, "-" вместо пути - не смонтирован. Кэш, в котором не хватает
+    // контроллеров (записан старой версией), недействителен.
+
+    if (fgets(line, sizeof(line), file) != NULL && strncmp(line, boot_id, BOOT_ID_SIZE) == 0 && line[BOOT_ID_SIZE] == '\n'
+        && fgets(line, sizeof(line), file) != NULL && sscanf(line, "%u", &found->version) == 1) {
+        size_t count = 0;
+
+        while (fgets(line, sizeof(line), file) != NULL) {
+            char *const path = strchr(line, ' ');
+
+            if (path == NULL)
+                continue;
+
+            *path = '\0';
+            path[strcspn(path + 1, "\n") + 1] = '\0';
+
+            for (size_t i = 0; i < CONTROLLERS_COUNT; i++) {
+                if (strcmp(line, controller_names[i]) != 0)
+                    continue;
+
+                if (strcmp(path + 1, "-") != 0)
+                    set_path(found->paths[i], path + 1);
+
+                count++;
+            }
+        }
+
+        loaded = (count == CONTROLLERS_COUNT);
+    }
+
+    fclose(file);
+
+    return (loaded && *found->paths[CONTROLLER_FREEZER] != '\0');
+}
+
+/*
+ * \fn void save_cache(const controllers_t *const found, const char *const boot_id)
+ * \brief Сохраняет точки монтирования контроллеров в кэш.
+ * \param const controllers_t *const found: Точки монтирования.
+ * \param const char *const boot_id: Идентификатор текущей загрузки.
+ * \note Кэш не обязателен, поэтому ошибки только логируются.
+ */
+static void save_cache(const controllers_t *const found, const char *const boot_id)
+{
+    char tmp_path[MAX_FILE_PATH];
+
+    // WARN: Пишем во временный файл и переименовываем, чтобы параллельно
+    // запущенные cgctl никогда не прочитали кэш наполовину.
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", MOUNTS_CACHE_FILE);
+
+    const int fd = mkstemp(tmp_path);
+
+    if (fd == -1) {
+        LOG_D("Unable to create cache file '%s', error '%m'.", tmp_path);
+        return;
+    }
+
+    FILE *const file = fdopen(fd, "w");
+
+    if (file == NULL) {
+        LOG_E("Unable to open cache file '%s', error '%m'.", tmp_path);
+        close(fd);
+        unlink(tmp_path);
+        return;
+    }
+
+    bool ok = (fchmod(fd, 0644) == 0 && fprintf(file, "%s\n%u\n", boot_id, found->version) > 0);
+
+    for (size_t i = 0; i < CONTROLLERS_COUNT && ok; i++)
+        ok = (fprintf(file, "%s %s\n", controller_names[i], ((*found->paths[i] == '\0') ? "-" : found->paths[i])) > 0);
+
+    if (fclose(file) == EOF)
+        ok = false;
+
+    if (!ok || rename(tmp_path, MOUNTS_CACHE_FILE) == -1) {
+        LOG_E("Unable to save cache file '%s', error '%m'.", MOUNTS_CACHE_FILE);
+        unlink(tmp_path);
+    }
+}
+
+/*
+ * \fn void build_mounts(const controllers_t *const found)
+ * \brief Объединяет контроллеры, смонтированные вместе, в иерархии.
+ * \param const controllers_t *const found: Точки монтирования контроллеров.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+static void build_mounts(const controllers_t *const found)
+{
+    // Без freezer не получится надёжно прибить процессы, а cgroup v2 заморозку умеет всегда.
+
+    if (*found->paths[CONTROLLER_FREEZER] == '\0') {
+        LOG_C("Freezer cgroup controller is not mounted.");
+        abort();
+    }
+
+    mounts.version = found->version;
+    mounts.count = 0;
+
+    // WARN: freezer обходим первым, поэтому его иерархия всегда основная.
+
+    for (size_t i = 0; i < CONTROLLERS_COUNT; i++) {
+        size_t hierarchy = 0;
+
+        if (*found->paths[i] != '\0') {
+            while (hierarchy < mounts.count && strcmp(mounts.paths[hierarchy], found->paths[i]) != 0)
+                hierarchy++;
+
+            if (hierarchy == mounts.count)
+                memcpy(mounts.paths[mounts.count++], found->paths[i], MAX_FILE_PATH);
+        } else
+            LOG_D("Cgroup controller '%s' is not mounted.", controller_names[i]);
+
+        mounts.hierarchies[i] = hierarchy;
+    }
+
+    for (size_t i = 0; i < mounts.count; i++)
+        LOG_D("Using cgroup v%u hierarchy '%s'.", mounts.version, mounts.paths[i]);
+}
+
+/*
+ * \fn void discover_mounts(const char *const boot_id)
+ * \brief Определяет иерархии разбором MOUNTINFO_FILE и сохраняет их в кэш.
+ * \param const char *const boot_id: Идентификатор текущей загрузки; NULL - кэш не сохранять.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+static void discover_mounts(const char *const boot_id)
+{
+    controllers_t found;
+
+    if (!parse_mountinfo(&found)) {
+        LOG_C("No cgroup hierarchies are mounted.");
+        abort();
+    }
+
+    build_mounts(&found);
+
+    mounts.cached = false;
+
+    if (boot_id != NULL)
+        save_cache(&found, boot_id);
+}
+
+const cgroup_mounts_t *get_mounts(void)
+{
+    char boot_id[BOOT_ID_SIZE + 1];
+    controllers_t found;
+
+    if (mounts.count != 0)
+        return &mounts;
+
+    // Разбор MOUNTINFO_FILE заметен на хостах с тысячами точек монтирования,
+    // а cgctl запускается часто и ненадолго. Кэш после перезагрузки недействителен.
+
+    const bool has_boot_id = read_boot_id(boot_id);
+
+    if (has_boot_id && load_cache(&found, boot_id)) {
+        build_mounts(&found);
+        mounts.cached = true;
+        return &mounts;
+    }
+
+    discover_mounts(((has_boot_id) ? boot_id : NULL));
+
+    return &mounts;
+}
+
+bool reload_mounts(void)
+{
+    char boot_id[BOOT_ID_SIZE + 1];
+
+    if (!get_mounts()->cached)
+        return false;
+
+    LOG_D("Cached cgroup hierarchies are outdated, rediscovering.");
+
+    discover_mounts(((read_boot_id(boot_id)) ? boot_id : NULL));
+
+    return true;
+}
+
+size_t get_file_hierarchy(const char *const file_name)
+{
+    const char *base = strrchr(file_name, '/');
+
+    base = ((base == NULL) ? file_name : base + 1);
+
+    const size_t len = strcspn(base, ".");
+
+    if (base[len] == '\0')
+        return 0; // "tasks" и т.п.
+
+    for (size_t i = 0; i < CONTROLLERS_COUNT; i++)
+        if (strlen(controller_names[i]) == len && strncmp(base, controller_names[i], len) == 0)
+            return get_mounts()->hierarchies[i];
+
+    return 0;
+}
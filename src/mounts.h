@@ -0,0 +1,68 @@
+#ifndef SRC_MOUNTS_H_
+#define SRC_MOUNTS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "utils.h"
+
+// точки монтирования текущего процесса
+#define MOUNTINFO_FILE ("/proc/self/mountinfo")
+
+// идентификатор текущей загрузки системы
+#define BOOT_ID_FILE ("/proc/sys/kernel/random/boot_id")
+
+/*
+ * Контроллеры cgroup, с которыми работаем. На v1 каждый может быть смонтирован
+ * в свою иерархию, на v2 все они в одной unified-иерархии.
+ */
+typedef enum
+{
+    CONTROLLER_FREEZER = 0, // основной: в его иерархии ищутся и прибиваются процессы
+    CONTROLLER_CPU,
+    CONTROLLER_CPUSET,
+    CONTROLLER_MEMORY,
+    CONTROLLER_BLKIO,
+    CONTROLLER_PIDS,
+    CONTROLLER_CPUACCT, // только статистика: на v2 её даёт cpu.stat
+    CONTROLLERS_COUNT
+} controller_t;
+
+// максимальное количество иерархий: на v1 каждый контроллер может быть смонтирован отдельно.
+#define MAX_HIERARCHIES (CONTROLLERS_COUNT)
+
+typedef struct
+{
+    unsigned int version; // версия cgroup: 1 или 2
+    size_t count; // количество различных иерархий
+    char paths[MAX_HIERARCHIES][MAX_FILE_PATH]; // точки монтирования иерархий; [0] - основная
+    size_t hierarchies[CONTROLLERS_COUNT]; // индекс иерархии контроллера в paths; 0 - если не смонтирован
+    bool cached; // прочитано из MOUNTS_CACHE_FILE, а не из MOUNTINFO_FILE
+} cgroup_mounts_t;
+
+/*
+ * \fn const cgroup_mounts_t *get_mounts(void)
+ * \brief Возвращает иерархии cgroup, определяя их при первом вызове: из кэша, если он
+ *        создан в текущую загрузку системы, иначе разбором MOUNTINFO_FILE.
+ * \return Иерархии cgroup.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+const cgroup_mounts_t *get_mounts(void);
+
+/*
+ * \fn bool reload_mounts(void)
+ * \brief Перечитывает иерархии из MOUNTINFO_FILE, если они были взяты из кэша, и обновляет кэш.
+ * \return true - если иерархии перечитаны; false - если они и так актуальны.
+ * \note Нужна, когда каталог из кэша не открывается: cgroup перемонтировали без перезагрузки.
+ */
+bool reload_mounts(void);
+
+/*
+ * \fn size_t get_file_hierarchy(const char *const file_name)
+ * \brief Определяет иерархию, в которой лежит файл cgroup, по префиксу названия ("memory.max" - memory).
+ * \param const char *const file_name: Название файла, возможно с путём ("web/cpuset.mems").
+ * \return Индекс иерархии в paths; файлы без контроллера ("tasks", "cgroup.procs") - в основной.
+ */
+size_t get_file_hierarchy(const char *const file_name);
+
+#endif /* SRC_MOUNTS_H_ */
@@ -0,0 +1,191 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "numa.h"
+#include "utils.h"
+
+/*
+ * \fn size_t parse_nodes(const char *const list, bool *nodes)
+ * \brief Разбирает список узлов в формате cpuset ("0-1,3").
+ * \param const char *const list: Список.
+ * \param bool *nodes: Массив из MAX_NUMA_NODES флагов, отмечаются перечисленные узлы.
+ * \return Количество перечисленных узлов.
+ */
+static size_t parse_nodes(const char *const list, bool *nodes)
+{
+    size_t count = 0;
+    const char *ch = list;
+
+    while (*ch >= '0' && *ch <= '9') {
+        char *end;
+
+        const unsigned long first = strtoul(ch, &end, 10);
+        unsigned long last = first;
+
+        if (*end == '-')
+            last = strtoul(end + 1, &end, 10);
+
+        for (unsigned long node = first; node <= last && node < MAX_NUMA_NODES; node++) {
+            nodes[node] = true;
+            count++;
+        }
+
+        ch = ((*end == ',') ? end + 1 : end);
+    }
+
+    return count;
+}
+
+/*
+ * \fn bool read_pinned_node(const group_dir_t *const root, const char *const name, unsigned long *node)
+ * \brief Определяет узел NUMA, к которому привязана cgroup.
+ * \param const group_dir_t *const root: Корневой каталог.
+ * \param const char *const name: Название cgroup.
+ * \param unsigned long *node: Номер узла.
+ * \return true - если cgroup привязана ровно к одному узлу; false - если нет.
+ */
+static bool read_pinned_node(const group_dir_t *const root, const char *const name, unsigned long *node)
+{
+    char buf[CPUSET_STR_SIZE];
+    char file_name[MAX_FILE_PATH];
+    ssize_t len = -1;
+
+    if (snprintf(file_name, sizeof(file_name), "%s/cpuset.mems", name) >= (int) sizeof(file_name))
+        return false;
+
+    // WARN: На v2 без контроллера cpuset файла нет вовсе, это не ошибка.
+    const int fd = open_file(root, file_name, O_RDONLY);
+
+    if (fd != -1) {
+        len = read(fd, buf, sizeof(buf) - 1);
+
+        if (close(fd) == -1) {
+            LOG_C("Unable to close cpuset.mems of group '%s', error '%m'.", name);
+            abort();
+        }
+    }
+
+    if (len <= 0)
+        return false;
+
+    buf[len] = '\0';
+
+    char *end;
+
+    *node = strtoul(buf, &end, 10);
+
+    return (end != buf && (*end == '\n' || *end == '\0'));
+}
+
+/*
+ * \fn int pick_node(const group_dir_t *const root, const group_dir_t *const dir)
+ * \brief Выбирает наименее загруженный узел NUMA: тот, к которому привязано меньше всего соседних cgroup.
+ * \param const group_dir_t *const root: Корневой каталог.
+ * \param const group_dir_t *const dir: Каталог cgroup, для которой выбирается узел.
+ * \return Номер узла.
+ */
+static int pick_node(const group_dir_t *const root, const group_dir_t *const dir)
+{
+    char buf[CPUSET_STR_SIZE];
+    bool online[MAX_NUMA_NODES] = { false };
+    size_t load[MAX_NUMA_NODES] = { 0 };
+
+    if (read_file(NUMA_ONLINE_FILE, buf, sizeof(buf)) == -1) {
+        LOG_C("Unable to get online NUMA nodes from '%s', error '%m'.", NUMA_ONLINE_FILE);
+        abort();
+    }
+
+    if (parse_nodes(buf, online) == 0) {
+        LOG_C("No online NUMA nodes found in '%s'.", NUMA_ONLINE_FILE);
+        abort();
+    }
+
+    // Загрузку узла считаем по cgroup, которые к нему уже привязаны. Обходим иерархию
+    // cpuset: на v1 в ней могут быть и cgroup, которых нет в основной.
+
+    const int root_fd = group_fd(root, "cpuset.mems");
+    const int fd = ((root_fd == -1) ? -1 : openat(root_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+
+    DIR *const groups = ((fd == -1) ? NULL : fdopendir(fd));
+
+    if (groups == NULL) {
+        LOG_C("Unable to open directory '%s', error '%m'.", root->name);
+        abort();
+    }
+
+    struct dirent *entry;
+
+    while ((entry = readdir(groups)) != NULL) {
+        unsigned long node;
+
+        if (entry->d_type != DT_DIR || *entry->d_name == '.' || strcmp(entry->d_name, dir->name) == 0)
+            continue;
+
+        if (read_pinned_node(root, entry->d_name, &node) && node < MAX_NUMA_NODES && online[node])
+            load[node]++;
+    }
+
+    if (closedir(groups) == -1) {
+        LOG_C("Unable to close directory '%s', error '%m'.", root->name);
+        abort();
+    }
+
+    int best = NUMA_NODE_NONE;
+
+    for (int node = 0; node < MAX_NUMA_NODES; node++)
+        if (online[node] && (best == NUMA_NODE_NONE || load[node] < load[best]))
+            best = node;
+
+    LOG_D("Picked NUMA node %d with %zu pinned groups.", best, load[best]);
+
+    return best;
+}
+
+void get_cpuset(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits, cpuset_t *cpuset)
+{
+    *cpuset->cpus = '\0';
+    *cpuset->mems = '\0';
+
+    if (limits->cpus != NULL && snprintf(cpuset->cpus, sizeof(cpuset->cpus), "%s\n", limits->cpus) >= (int) sizeof(cpuset->cpus)) {
+        LOG_C("CPU list '%s' is too long.", limits->cpus);
+        abort();
+    }
+
+    if (limits->numa_node == NUMA_NODE_NONE)
+        return;
+
+    const int node = ((limits->numa_node == NUMA_NODE_AUTO) ? pick_node(root, dir) : limits->numa_node);
+
+    if (snprintf(cpuset->mems, sizeof(cpuset->mems), "%d\n", node) < 0) {
+        LOG_C("Unable to format NUMA node %d, error '%m'.", node);
+        abort();
+    }
+
+    // Явно заданный список CPU важнее, иначе берём все CPU узла.
+
+    if (*cpuset->cpus != '\0')
+        return;
+
+    char file_path[MAX_FILE_PATH];
+
+    if (snprintf(file_path, sizeof(file_path), "%s/node%d/cpulist", NUMA_NODES_DIR, node) < 0) {
+        LOG_C("Unable to format file path for NUMA node %d, error '%m'.", node);
+        abort();
+    }
+
+    if (read_file(file_path, cpuset->cpus, sizeof(cpuset->cpus)) <= 1) {
+        LOG_C("Unable to get CPUs of NUMA node %d, node is offline or has no CPUs.", node);
+        abort();
+    }
+
+    LOG_D("Using CPUs '%.*s' of NUMA node %d.", (int) strcspn(cpuset->cpus, "\n"), cpuset->cpus, node);
+}
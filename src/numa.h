@@ -0,0 +1,33 @@
+#ifndef SRC_NUMA_H_
+#define SRC_NUMA_H_
+
+#include "cgroup.h"
+#include "group.h"
+
+// каталог с описанием узлов NUMA
+#define NUMA_NODES_DIR ("/sys/devices/system/node")
+
+// список узлов NUMA в сети
+#define NUMA_ONLINE_FILE ("/sys/devices/system/node/online")
+
+// размер буфера для списков CPU и узлов в формате cpuset
+#define CPUSET_STR_SIZE (1024)
+
+typedef struct
+{
+    char cpus[CPUSET_STR_SIZE]; // значение для cpuset.cpus; пустая строка - не задано
+    char mems[CPUSET_STR_SIZE]; // значение для cpuset.mems; пустая строка - не задано
+} cpuset_t;
+
+/*
+ * \fn void get_cpuset(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits, cpuset_t *cpuset)
+ * \brief Вычисляет cpuset cgroup по заданным опциям: явному списку CPU и/или узлу NUMA.
+ * \param const group_dir_t *const root: Корневой каталог, среди его потомков считается загрузка узлов.
+ * \param const group_dir_t *const dir: Каталог cgroup, сама она при подсчёте загрузки не учитывается.
+ * \param const cgroup_limits_t *const limits: Ограничения.
+ * \param cpuset_t *cpuset: Вычисленный cpuset, строки завершаются переводом строки.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+void get_cpuset(const group_dir_t *const root, const group_dir_t *const dir, const cgroup_limits_t *const limits, cpuset_t *cpuset);
+
+#endif /* SRC_NUMA_H_ */
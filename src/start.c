@@ -11,6 +11,7 @@
 #include "cgroup.h"
 #include "log.h"
 #include "privileges.h"
+#include "timings.h"
 #include "utils.h"
 
 #define PROG_NAME ("cgctl-start")
@@ -19,13 +20,25 @@ static void show_usage(void)
 {
     // clang-format off
     const char *const usage =
-        "Usage: %s [-h|--help] [-d|--debug] [-g|--group=NAME] [-c|--cpu-usage=NUM] [-m|--mem-usage=NUM] [-u|--user=USER] -- PROG [ARGS...]\n"
+        "Usage: %s [-h|--help] [-d|--debug] [-g|--group=NAME] [-c|--cpu-usage=NUM] [-m|--mem-usage=NUM] [-H|--mem-high=SIZE] [-q|--cpu-quota=NUM] [-p|--cpu-period=US] [-C|--cpus=LIST] [-n|--numa-node=NODE] [-M|--memory-migrate] [-w|--io-weight=NUM] [-i|--io-max=LIMITS] [-t|--max-tasks=NUM] [-u|--user=USER] [-T|--timings] [-l|--log=TARGET] [-F|--log-format=FORMAT] -- PROG [ARGS...]\n"
         "\t-h|--help: show this help;\n"
         "\t-d|--debug: enable debug mode;\n"
         "\t-g|--group=NAME: group name (same as PROG name by default);\n"
         "\t-c|--cpu-usage=NUM: set maximum CPU usage, percent (100%% by default);\n"
         "\t-m|--mem-usage=NUM: set maximum memory usage, percent (100%% by default);\n"
+        "\t-H|--mem-high=SIZE: reclaim memory above SIZE before the maximum, NUM%% of RAM or bytes with K/M/G suffix (disabled by default);\n"
+        "\t-q|--cpu-quota=NUM: set hard CPU limit, NUM%% of all cores or cores count, e.g. 1.5 (no limit by default);\n"
+        "\t-p|--cpu-period=US: set CPU quota period, microseconds (100000 by default);\n"
+        "\t-C|--cpus=LIST: run only on these CPUs, e.g. 0-3,8 (all CPUs by default);\n"
+        "\t-n|--numa-node=NODE: run on CPUs and allocate memory of NUMA node NODE, or the least loaded one if 'auto';\n"
+        "\t-M|--memory-migrate: move memory of the tasks when the NUMA node changes;\n"
+        "\t-w|--io-weight=NUM: set relative I/O weight, 1..10000 (100 by default);\n"
+        "\t-i|--io-max=LIMITS: limit I/O of a disk, e.g. sda:rbps=10M,wiops=100, may be repeated (no limit by default);\n"
+        "\t-t|--max-tasks=NUM: set maximum number of tasks (processes and threads) in the group (no limit by default);\n"
         "\t-u|--user=USER: drop privileges to USER;\n"
+        "\t-T|--timings: print durations of the creation phases as a JSON line to stderr;\n"
+        "\t-l|--log=TARGET: write log to syslog, stderr or a file (syslog by default);\n"
+        "\t-F|--log-format=FORMAT: log format, text, kv (key=value) or json (text by default);\n"
         "\tPROG: program to run;\n"
         "\tARGS: program arguments;\n"
     ;
@@ -38,9 +51,9 @@ int main(int argc, char **argv)
 {
     int opt;
     bool debug = false;
+    bool timings = false;
     char *user_name = NULL;
-    unsigned int cpu_usage = 100;
-    unsigned int mem_usage = 100;
+    cgroup_limits_t limits;
     char group[MAX_FILE_PATH];
 
     static struct option long_opts[] = {
@@ -49,13 +62,27 @@ int main(int argc, char **argv)
         { "group", required_argument, 0, 'g' },
         { "cpu-usage", required_argument, 0, 'c' },
         { "mem-usage", required_argument, 0, 'm' },
+        { "mem-high", required_argument, 0, 'H' },
+        { "cpu-quota", required_argument, 0, 'q' },
+        { "cpu-period", required_argument, 0, 'p' },
+        { "cpus", required_argument, 0, 'C' },
+        { "numa-node", required_argument, 0, 'n' },
+        { "memory-migrate", no_argument, 0, 'M' },
+        { "io-weight", required_argument, 0, 'w' },
+        { "io-max", required_argument, 0, 'i' },
+        { "max-tasks", required_argument, 0, 't' },
         { "user", required_argument, 0, 'u' },
+        { "timings", no_argument, 0, 'T' },
+        { "log", required_argument, 0, 'l' },
+        { "log-format", required_argument, 0, 'F' },
         { 0, 0, 0, 0 }
     };
 
     *group = '\0';
 
-    while ((opt = getopt_long(argc, argv, "hdg:c:m:u:", long_opts, 0)) != -1)
+    cgroup_limits_init(&limits);
+
+    while ((opt = getopt_long(argc, argv, "hdg:c:m:H:q:p:C:n:Mw:i:t:u:Tl:F:", long_opts, 0)) != -1)
         switch (opt) {
             case 'h':
                 show_usage();
@@ -77,11 +104,47 @@ int main(int argc, char **argv)
                 break;
 
             case 'c':
-                cpu_usage = get_cpu_usage(optarg);
+                limits.cpu_usage = get_cpu_usage(optarg);
                 break;
 
             case 'm':
-                mem_usage = get_mem_usage(optarg);
+                limits.mem_usage = get_mem_usage(optarg);
+                break;
+
+            case 'H':
+                limits.mem_high = get_mem_size(optarg);
+                break;
+
+            case 'q':
+                limits.cpu_quota = get_cpu_quota(optarg);
+                break;
+
+            case 'p':
+                limits.cpu_period_us = get_cpu_period(optarg);
+                break;
+
+            case 'C':
+                limits.cpus = get_cpu_list(optarg);
+                break;
+
+            case 'n':
+                limits.numa_node = get_numa_node(optarg);
+                break;
+
+            case 'M':
+                limits.memory_migrate = true;
+                break;
+
+            case 'w':
+                limits.io_weight = get_io_weight(optarg);
+                break;
+
+            case 'i':
+                get_io_max(optarg, &limits);
+                break;
+
+            case 't':
+                limits.max_tasks = get_max_tasks(optarg);
                 break;
 
             case 'u':
@@ -92,6 +155,24 @@ int main(int argc, char **argv)
                 user_name = optarg;
                 break;
 
+            case 'T':
+                timings = true;
+                break;
+
+            case 'l':
+                if (log_set_target(optarg) != 0) {
+                    fprintf(stderr, "Error: Unable to open log file '%s', error '%m'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'F':
+                if (log_set_format(optarg) != 0) {
+                    fprintf(stderr, "Error: Unknown log format '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
             default:
                 fprintf(stderr, "Error: Unknown argument '%c'.\n", opt);
                 return EXIT_FAILURE;
@@ -115,9 +196,18 @@ int main(int argc, char **argv)
 
     log_open(PROG_NAME, debug);
 
-    LOG_D("Started with group='%s', cpu_usage=%u, mem_usage=%u.", group, cpu_usage, mem_usage);
+    LOG_D("Started with group='%s', cpu_usage=%u, mem_usage=%u, cpu_quota=%u/1000.",
+        group, limits.cpu_usage, limits.mem_usage, limits.cpu_quota);
+
+    timings_init(timings);
+
+    cgroup_create(group, &limits);
+
+    timings_report("start", group, EXIT_SUCCESS);
 
-    cgroup_create(group, cpu_usage, mem_usage);
+    // WARN: Программа запускается через exec(2) в этом же процессе (upstart следит за его pid),
+    // поэтому переносим в cgroup сам процесс, а не создаём в ней дочерний.
+    cgroup_append(group);
 
     if (user_name != NULL) {
         LOG_D("Dropping privileges to user '%s'.", user_name);
@@ -0,0 +1,675 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <dirent.h>
+#include <err.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "group.h"
+#include "log.h"
+#include "tasks.h"
+#include "utils.h"
+
+#define PROG_NAME ("cgctl-stat")
+
+// байт в мегабайте, для таблицы
+#define MB (1048576.0)
+
+// формат вывода
+typedef enum
+{
+    FORMAT_TABLE = 0,
+    FORMAT_JSON,
+    FORMAT_METRICS // OpenMetrics, например для textfile collector'а node_exporter
+} format_t;
+
+/*
+ * Снимок одной cgroup. Каталог и файлы статистики открываются один раз и
+ * переиспользуются во всех следующих снимках, пока группа существует.
+ */
+typedef struct
+{
+    char *name; // название cgroup
+    group_dir_t dir; // каталог cgroup
+    bool opened; // каталог открыт
+    bool failed; // cgroup не открылась или пропала во время чтения
+    ssize_t tasks; // количество процессов
+    group_usage_t usage; // потребление ресурсов (в режиме скорости - второй снимок)
+    group_usage_t prev; // первый снимок в режиме скорости
+} group_stat_t;
+
+// группы, отсортированные по названию
+typedef struct
+{
+    group_stat_t *items; // группы
+    size_t count; // количество групп
+} group_list_t;
+
+// метрика OpenMetrics, значение которой берётся из group_usage_t
+typedef struct
+{
+    const char *name; // название семейства метрик
+    const char *type; // counter или gauge
+    const char *unit; // единица измерения или NULL
+    const char *help; // описание
+    size_t offset; // смещение поля в group_usage_t
+    double scale; // множитель значения, например 1e-9 для перевода наносекунд в секунды
+} metric_t;
+
+// clang-format off
+static const metric_t metrics[] = {
+    { "cgctl_cpu_usage_seconds", "counter", "seconds", "CPU time consumed by the group.", offsetof(group_usage_t, cpu_usage_ns), 1e-9 },
+    { "cgctl_cpu_periods", "counter", NULL, "CPU quota periods elapsed.", offsetof(group_usage_t, nr_periods), 1 },
+    { "cgctl_cpu_throttled_periods", "counter", NULL, "CPU quota periods in which the group was throttled.", offsetof(group_usage_t, nr_throttled), 1 },
+    { "cgctl_cpu_throttled_seconds", "counter", "seconds", "Time the group was throttled by the CPU quota.", offsetof(group_usage_t, throttled_ns), 1e-9 },
+    { "cgctl_memory_usage_bytes", "gauge", "bytes", "Memory used by the group.", offsetof(group_usage_t, mem_usage), 1 },
+    { "cgctl_memory_peak_bytes", "gauge", "bytes", "Peak memory used by the group.", offsetof(group_usage_t, mem_peak), 1 },
+    { "cgctl_memory_anon_bytes", "gauge", "bytes", "Anonymous memory of the group.", offsetof(group_usage_t, mem_anon), 1 },
+    { "cgctl_memory_file_bytes", "gauge", "bytes", "Page cache of the group.", offsetof(group_usage_t, mem_file), 1 },
+    { "cgctl_memory_swap_bytes", "gauge", "bytes", "Swap used by the group.", offsetof(group_usage_t, mem_swap), 1 },
+    { "cgctl_memory_major_faults", "counter", NULL, "Major page faults in the group.", offsetof(group_usage_t, pgmajfault), 1 }
+};
+// clang-format on
+
+static void show_usage(void)
+{
+    // clang-format off
+    const char *const usage =
+        "Usage: %s [-h|--help] [-d|--debug] [-j|--json] [-m|--metrics] [-r|--rate=MS] [-l|--loop=MS] [-o|--output=FILE] [GROUP...]\n"
+        "\t-h|--help: show this help;\n"
+        "\t-d|--debug: enable debug mode;\n"
+        "\t-j|--json: print JSON instead of a table;\n"
+        "\t-m|--metrics: print OpenMetrics instead of a table;\n"
+        "\t-r|--rate=MS: take two snapshots MS milliseconds apart and print CPU, throttling and page fault rates;\n"
+        "\t-l|--loop=MS: repeat every MS milliseconds, following groups as they appear and disappear;\n"
+        "\t-o|--output=FILE: atomically replace FILE instead of printing to stdout;\n"
+        "\tGROUP: group name (all groups by default);\n"
+    ;
+    // clang-format on
+
+    fprintf(stdout, usage, PROG_NAME);
+}
+
+/*
+ * \fn int compare_names(const void *a, const void *b)
+ * \brief Сравнивает названия групп для qsort(3).
+ */
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/*
+ * \fn void add_name(char ***names, size_t *count, size_t *size, const char *const name)
+ * \brief Добавляет копию названия группы в массив, увеличивая его при необходимости.
+ * \warning В случае ошибок функция завершает программу с кодом 1.
+ */
+static void add_name(char ***names, size_t *count, size_t *size, const char *const name)
+{
+    if (*count == *size) {
+        *size = ((*size == 0) ? 16 : *size * 2);
+
+        if ((*names = realloc(*names, *size * sizeof(**names))) == NULL)
+            err(EXIT_FAILURE, "Unable to allocate memory");
+    }
+
+    if (((*names)[(*count)++] = strdup(name)) == NULL)
+        err(EXIT_FAILURE, "Unable to allocate memory");
+}
+
+/*
+ * \fn char **get_names(const int args_count, char **args, size_t *count)
+ * \brief Возвращает отсортированные названия групп без повторов: заданные или все группы
+ *        верхнего уровня основной иерархии.
+ * \param const int args_count: Количество заданных групп; 0 - все группы.
+ * \param char **args: Заданные группы.
+ * \param size_t *count: Указатель на переменную, в которую помещается количество групп.
+ * \return Массив названий, освобождается вызывающим вместе с названиями.
+ * \warning В случае ошибок функция завершает программу с кодом 1.
+ */
+static char **get_names(const int args_count, char **args, size_t *count)
+{
+    char **names = NULL;
+    size_t size = 0;
+
+    *count = 0;
+
+    if (args_count != 0)
+        for (int i = 0; i < args_count; i++)
+            add_name(&names, count, &size, args[i]);
+    else {
+        // WARN: fdopendir(3) не работает с каталогами, открытыми с O_PATH, поэтому открываем по пути.
+        DIR *dir = opendir(get_root_dir()->name);
+
+        if (dir == NULL)
+            err(EXIT_FAILURE, "Unable to open directory '%s'", get_root_dir()->name);
+
+        struct dirent *entry;
+
+        while ((entry = readdir(dir)) != NULL)
+            if (entry->d_type == DT_DIR && entry->d_name[0] != '.')
+                add_name(&names, count, &size, entry->d_name);
+
+        closedir(dir);
+    }
+
+    if (*count == 0)
+        return names;
+
+    qsort(names, *count, sizeof(*names), compare_names);
+
+    size_t unique = 1;
+
+    for (size_t i = 1; i < *count; i++)
+        if (strcmp(names[i], names[unique - 1]) == 0)
+            free(names[i]);
+        else
+            names[unique++] = names[i];
+
+    *count = unique;
+
+    return names;
+}
+
+/*
+ * \fn void raise_files_limit(void)
+ * \brief Поднимает мягкий лимит открытых файлов до жёсткого: у каждой группы открыто по
+ *        каталогу в каждой иерархии и по дескриптору на файл статистики.
+ */
+static void raise_files_limit(void)
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == limit.rlim_max)
+        return;
+
+    limit.rlim_cur = limit.rlim_max;
+
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1)
+        LOG_E("Unable to raise open files limit, error '%m'.");
+}
+
+/*
+ * \fn void drop_group(group_stat_t *stat)
+ * \brief Закрывает группу и освобождает её название.
+ * \param group_stat_t *stat: Группа.
+ */
+static void drop_group(group_stat_t *stat)
+{
+    if (stat->opened)
+        group_close(&stat->dir);
+
+    free(stat->name);
+}
+
+/*
+ * \fn void sync_groups(group_list_t *list, char **names, const size_t count, const bool quiet)
+ * \brief Приводит список групп в соответствие с названиями: уже открытые группы остаются
+ *        открытыми, новые открываются, исчезнувшие закрываются.
+ * \param group_list_t *list: Список групп.
+ * \param char **names: Отсортированные названия групп, владение ими переходит к списку.
+ * \param const size_t count: Количество названий.
+ * \param const bool quiet: Не сообщать о группах, которые не удалось открыть.
+ * \warning В случае ошибок функция завершает программу с кодом 1.
+ */
+static void sync_groups(group_list_t *list, char **names, const size_t count, const bool quiet)
+{
+    group_stat_t *items = calloc(count + 1, sizeof(*items)); // +1 чтобы не получить NULL при count == 0
+
+    if (items == NULL)
+        err(EXIT_FAILURE, "Unable to allocate memory");
+
+    size_t old = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        group_stat_t *const stat = &items[i];
+
+        while (old < list->count && strcmp(list->items[old].name, names[i]) < 0)
+            drop_group(&list->items[old++]);
+
+        if (old < list->count && strcmp(list->items[old].name, names[i]) == 0) {
+            *stat = list->items[old++];
+            free(names[i]);
+        } else
+            stat->name = names[i];
+
+        // Пропавшую группу могли пересоздать, тогда её старый каталог уже недействителен.
+        if (stat->failed && stat->opened) {
+            group_close(&stat->dir);
+            stat->opened = false;
+        }
+
+        if (stat->opened)
+            continue;
+
+        stat->failed = (group_open(&stat->dir, get_root_dir(), stat->name) != 0);
+        stat->opened = !stat->failed;
+        memset(&stat->usage, 0, sizeof(stat->usage));
+
+        if (stat->failed && !quiet)
+            fprintf(stderr, "Warning: Unable to open group '%s': %m.\n", stat->name);
+    }
+
+    while (old < list->count)
+        drop_group(&list->items[old++]);
+
+    free(list->items);
+
+    list->items = items;
+    list->count = count;
+}
+
+/*
+ * \fn void take_snapshot(group_list_t *list, const bool quiet)
+ * \brief Читает потребление ресурсов всех групп.
+ * \param group_list_t *list: Список групп.
+ * \param const bool quiet: Не сообщать о группах, которые не удалось прочитать.
+ */
+static void take_snapshot(group_list_t *list, const bool quiet)
+{
+    const cgroup_backend_t *const backend = get_backend();
+
+    for (size_t i = 0; i < list->count; i++) {
+        group_stat_t *const stat = &list->items[i];
+
+        if (stat->failed)
+            continue;
+
+        stat->prev = stat->usage;
+
+        if ((stat->tasks = count_tasks(&stat->dir)) == -1 || backend->get_usage(&stat->dir, &stat->usage) != 0) {
+            if (!quiet)
+                fprintf(stderr, "Warning: Unable to read usage of group '%s'.\n", stat->name);
+
+            stat->failed = true;
+        }
+    }
+}
+
+/*
+ * \fn double per_second(const uint64_t cur, const uint64_t prev, const uint64_t elapsed_us)
+ * \brief Считает скорость изменения счётчика.
+ * \param const uint64_t cur: Текущее значение.
+ * \param const uint64_t prev: Предыдущее значение.
+ * \param const uint64_t elapsed_us: Время между снимками, микросекунд.
+ * \return Изменение в секунду; 0 если счётчик уменьшился (например, cgroup пересоздали).
+ */
+static double per_second(const uint64_t cur, const uint64_t prev, const uint64_t elapsed_us)
+{
+    return ((cur > prev) ? (cur - prev) * 1000000.0 / elapsed_us : 0.0);
+}
+
+/*
+ * \fn void print_table(FILE *out, const group_list_t *const list, const uint64_t elapsed_us)
+ * \brief Выводит таблицу потребления ресурсов.
+ * \param FILE *out: Куда выводить.
+ * \param const group_list_t *const list: Список групп.
+ * \param const uint64_t elapsed_us: Время между снимками, микросекунд; 0 - снимок один.
+ */
+static void print_table(FILE *out, const group_list_t *const list, const uint64_t elapsed_us)
+{
+    if (elapsed_us == 0)
+        fprintf(out, "%-32s %6s %10s %9s %10s %9s %9s %9s %9s %9s %9s\n", "GROUP", "TASKS", "CPU_S", "THROTTLED", "THR_MS",
+                "MEM_MB", "PEAK_MB", "ANON_MB", "FILE_MB", "SWAP_MB", "MAJFLT");
+    else
+        fprintf(out, "%-32s %6s %10s %9s %10s %9s %9s %9s %9s %9s %9s\n", "GROUP", "TASKS", "CPU%", "THR/s", "THR_MS/s",
+                "MEM_MB", "PEAK_MB", "ANON_MB", "FILE_MB", "SWAP_MB", "MAJFLT/s");
+
+    for (size_t i = 0; i < list->count; i++) {
+        const group_stat_t *const stat = &list->items[i];
+        const group_usage_t *const cur = &stat->usage;
+        const group_usage_t *const prev = &stat->prev;
+
+        if (stat->failed)
+            continue;
+
+        fprintf(out, "%-32s %6zd ", stat->name, stat->tasks);
+
+        if (elapsed_us == 0)
+            fprintf(out, "%10.2f %9" PRIu64 " %10.1f ", cur->cpu_usage_ns / 1e9, cur->nr_throttled, cur->throttled_ns / 1e6);
+        else
+            fprintf(out, "%10.1f %9.1f %10.1f ", per_second(cur->cpu_usage_ns, prev->cpu_usage_ns, elapsed_us) / 1e7,
+                    per_second(cur->nr_throttled, prev->nr_throttled, elapsed_us),
+                    per_second(cur->throttled_ns, prev->throttled_ns, elapsed_us) / 1e6);
+
+        fprintf(out, "%9.1f %9.1f %9.1f %9.1f %9.1f ", cur->mem_usage / MB, cur->mem_peak / MB, cur->mem_anon / MB,
+                cur->mem_file / MB, cur->mem_swap / MB);
+
+        if (elapsed_us == 0)
+            fprintf(out, "%9" PRIu64 "\n", cur->pgmajfault);
+        else
+            fprintf(out, "%9.1f\n", per_second(cur->pgmajfault, prev->pgmajfault, elapsed_us));
+    }
+}
+
+/*
+ * \fn void print_json(FILE *out, const group_list_t *const list, const uint64_t elapsed_us)
+ * \brief Выводит потребление ресурсов массивом JSON, по объекту на группу.
+ * \param FILE *out: Куда выводить.
+ * \param const group_list_t *const list: Список групп.
+ * \param const uint64_t elapsed_us: Время между снимками, микросекунд; 0 - снимок один.
+ * \note Счётчики выводятся как есть, в режиме скорости к ним добавляются скорости в секунду.
+ */
+static void print_json(FILE *out, const group_list_t *const list, const uint64_t elapsed_us)
+{
+    bool first = true;
+
+    fputc('[', out);
+
+    for (size_t i = 0; i < list->count; i++) {
+        const group_stat_t *const stat = &list->items[i];
+        const group_usage_t *const cur = &stat->usage;
+        const group_usage_t *const prev = &stat->prev;
+
+        if (stat->failed)
+            continue;
+
+        fputs((first ? "{\"group\":" : ",{\"group\":"), out);
+        print_json_string(out, stat->name);
+        first = false;
+
+        fprintf(out,
+                ",\"tasks\":%zd,\"cpu_usage_ns\":%" PRIu64 ",\"nr_periods\":%" PRIu64 ",\"nr_throttled\":%" PRIu64
+                ",\"throttled_ns\":%" PRIu64 ",\"mem_usage\":%" PRIu64 ",\"mem_peak\":%" PRIu64 ",\"mem_anon\":%" PRIu64
+                ",\"mem_file\":%" PRIu64 ",\"mem_swap\":%" PRIu64 ",\"pgmajfault\":%" PRIu64,
+                stat->tasks, cur->cpu_usage_ns, cur->nr_periods, cur->nr_throttled, cur->throttled_ns, cur->mem_usage,
+                cur->mem_peak, cur->mem_anon, cur->mem_file, cur->mem_swap, cur->pgmajfault);
+
+        if (elapsed_us != 0)
+            fprintf(out,
+                    ",\"interval_us\":%" PRIu64 ",\"cpu_percent\":%.2f,\"throttled_per_sec\":%.2f"
+                    ",\"throttled_ms_per_sec\":%.2f,\"pgmajfault_per_sec\":%.2f",
+                    elapsed_us, per_second(cur->cpu_usage_ns, prev->cpu_usage_ns, elapsed_us) / 1e7,
+                    per_second(cur->nr_throttled, prev->nr_throttled, elapsed_us),
+                    per_second(cur->throttled_ns, prev->throttled_ns, elapsed_us) / 1e6,
+                    per_second(cur->pgmajfault, prev->pgmajfault, elapsed_us));
+
+        fputc('}', out);
+    }
+
+    fputs("]\n", out);
+}
+
+/*
+ * \fn void print_label(FILE *out, const char *const value)
+ * \brief Выводит значение метки OpenMetrics в кавычках.
+ * \param FILE *out: Куда выводить.
+ * \param const char *const value: Значение.
+ */
+static void print_label(FILE *out, const char *const value)
+{
+    fputc('"', out);
+
+    for (const char *p = value; *p != '\0'; p++)
+        if (*p == '"' || *p == '\\')
+            fprintf(out, "\\%c", *p);
+        else if (*p == '\n')
+            fputs("\\n", out);
+        else
+            fputc(*p, out);
+
+    fputc('"', out);
+}
+
+/*
+ * \fn void print_metrics(FILE *out, const group_list_t *const list, const uint64_t scrape_us)
+ * \brief Выводит потребление ресурсов в формате OpenMetrics.
+ * \param FILE *out: Куда выводить.
+ * \param const group_list_t *const list: Список групп.
+ * \param const uint64_t scrape_us: Время чтения статистики, микросекунд.
+ */
+static void print_metrics(FILE *out, const group_list_t *const list, const uint64_t scrape_us)
+{
+    fputs("# TYPE cgctl_tasks gauge\n# HELP cgctl_tasks Processes in the group.\n", out);
+
+    for (size_t i = 0; i < list->count; i++)
+        if (!list->items[i].failed) {
+            fputs("cgctl_tasks{group=", out);
+            print_label(out, list->items[i].name);
+            fprintf(out, "} %zd\n", list->items[i].tasks);
+        }
+
+    for (size_t m = 0; m < sizeof(metrics) / sizeof(metrics[0]); m++) {
+        const metric_t *const metric = &metrics[m];
+
+        // У счётчиков OpenMetrics к названию семейства в значениях добавляется суффикс _total.
+        const char *const suffix = ((strcmp(metric->type, "counter") == 0) ? "_total" : "");
+
+        fprintf(out, "# TYPE %s %s\n", metric->name, metric->type);
+
+        if (metric->unit != NULL)
+            fprintf(out, "# UNIT %s %s\n", metric->name, metric->unit);
+
+        fprintf(out, "# HELP %s %s\n", metric->name, metric->help);
+
+        for (size_t i = 0; i < list->count; i++) {
+            const group_stat_t *const stat = &list->items[i];
+
+            if (stat->failed)
+                continue;
+
+            const uint64_t value = *(const uint64_t *) ((const char *) &stat->usage + metric->offset);
+
+            fprintf(out, "%s%s{group=", metric->name, suffix);
+            print_label(out, stat->name);
+
+            if (metric->scale == 1)
+                fprintf(out, "} %" PRIu64 "\n", value);
+            else
+                fprintf(out, "} %.9f\n", value * metric->scale);
+        }
+    }
+
+    fprintf(out, "# TYPE cgctl_scrape_duration_seconds gauge\n# UNIT cgctl_scrape_duration_seconds seconds\n"
+                 "# HELP cgctl_scrape_duration_seconds Time spent reading the statistics.\n"
+                 "cgctl_scrape_duration_seconds %.6f\n# EOF\n",
+            scrape_us / 1e6);
+}
+
+/*
+ * \fn int write_output(const char *const path, const format_t format, const group_list_t *const list, const uint64_t elapsed_us, const uint64_t scrape_us)
+ * \brief Выводит потребление ресурсов в заданном формате.
+ * \param const char *const path: Файл, который нужно заменить, или NULL для вывода в stdout.
+ * \param const format_t format: Формат вывода.
+ * \param const group_list_t *const list: Список групп.
+ * \param const uint64_t elapsed_us: Время между снимками, микросекунд; 0 - снимок один.
+ * \param const uint64_t scrape_us: Время чтения статистики, микросекунд.
+ * \return 1 в случае ошибок; 0 если всё выведено.
+ */
+static int write_output(const char *const path, const format_t format, const group_list_t *const list,
+                        const uint64_t elapsed_us, const uint64_t scrape_us)
+{
+    char tmp_path[MAX_FILE_PATH];
+    FILE *out = stdout;
+
+    if (path != NULL) {
+        // WARN: Пишем во временный файл и переименовываем, чтобы читатель (например,
+        // node_exporter) никогда не увидел файл наполовину. Суффикс после ".prom"
+        // не даёт textfile collector'у подхватить временный файл.
+
+        if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int) sizeof(tmp_path)) {
+            fprintf(stderr, "Error: Output path '%s' is too long.\n", path);
+            return 1;
+        }
+
+        const int fd = mkstemp(tmp_path);
+
+        if (fd == -1 || fchmod(fd, 0644) == -1 || (out = fdopen(fd, "w")) == NULL) {
+            fprintf(stderr, "Error: Unable to create file '%s': %m.\n", tmp_path);
+
+            if (fd != -1) {
+                close(fd);
+                unlink(tmp_path);
+            }
+
+            return 1;
+        }
+    }
+
+    switch (format) {
+        case FORMAT_TABLE:
+            print_table(out, list, elapsed_us);
+            break;
+
+        case FORMAT_JSON:
+            print_json(out, list, elapsed_us);
+            break;
+
+        case FORMAT_METRICS:
+            print_metrics(out, list, scrape_us);
+            break;
+    }
+
+    if (path == NULL)
+        return ((fflush(out) == EOF) ? 1 : 0);
+
+    if (fclose(out) == EOF || rename(tmp_path, path) == -1) {
+        fprintf(stderr, "Error: Unable to write file '%s': %m.\n", path);
+        unlink(tmp_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    bool debug = false;
+    format_t format = FORMAT_TABLE;
+    unsigned int rate_ms = 0;
+    unsigned int loop_ms = 0;
+    const char *output = NULL;
+
+    static struct option long_opts[] = {
+        { "help", no_argument, 0, 'h' },
+        { "debug", no_argument, 0, 'd' },
+        { "json", no_argument, 0, 'j' },
+        { "metrics", no_argument, 0, 'm' },
+        { "rate", required_argument, 0, 'r' },
+        { "loop", required_argument, 0, 'l' },
+        { "output", required_argument, 0, 'o' },
+        { 0, 0, 0, 0 }
+    };
+
+    while ((opt = getopt_long(argc, argv, "hdjmr:l:o:", long_opts, 0)) != -1)
+        switch (opt) {
+            case 'h':
+                show_usage();
+                return EXIT_FAILURE;
+
+            case 'd':
+                debug = true;
+                break;
+
+            case 'j':
+                format = FORMAT_JSON;
+                break;
+
+            case 'm':
+                format = FORMAT_METRICS;
+                break;
+
+            case 'r':
+                rate_ms = get_timeout(optarg);
+                break;
+
+            case 'l':
+                loop_ms = get_timeout(optarg);
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                fprintf(stderr, "Error: Unknown argument '%c'.\n", opt);
+                return EXIT_FAILURE;
+        }
+
+    if (rate_ms != 0 && loop_ms != 0) {
+        fprintf(stderr, "Error: Options --rate and --loop are mutually exclusive.\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = optind; i < argc; i++)
+        if (*argv[i] == '\0' || strchr(argv[i], '/') != NULL) {
+            fprintf(stderr, "Error: Invalid group name '%s'.\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+
+    log_open(PROG_NAME, debug);
+    raise_files_limit();
+
+    // В цикле группы появляются и исчезают штатно, сообщать об этом незачем.
+    const bool quiet = (loop_ms != 0);
+
+    group_list_t list = { .items = NULL, .count = 0 };
+    uint64_t next_us = get_monotonic_us();
+    int exit_code;
+
+    for (;;) {
+        size_t count;
+        char **names = get_names(argc - optind, argv + optind, &count);
+
+        // Каталоги и файлы статистики уже открытых групп переиспользуются, поэтому снимок -
+        // это только pread(2) файлов статистики и чтение списка процессов.
+        sync_groups(&list, names, count, quiet);
+        free(names);
+
+        uint64_t started_us = get_monotonic_us();
+        uint64_t elapsed_us = 0;
+
+        take_snapshot(&list, quiet);
+
+        if (rate_ms != 0) {
+            usleep(rate_ms * 1000u);
+
+            const uint64_t now_us = get_monotonic_us();
+
+            take_snapshot(&list, quiet);
+
+            elapsed_us = now_us - started_us;
+            started_us = now_us;
+        }
+
+        exit_code = write_output(output, format, &list, elapsed_us, get_monotonic_us() - started_us);
+
+        for (size_t i = 0; i < list.count && exit_code == 0; i++)
+            if (list.items[i].failed)
+                exit_code = 1;
+
+        if (loop_ms == 0)
+            break;
+
+        log_flush(); // лимит одинаковых записей лога действует в пределах одного снимка
+
+        // Ровный шаг без накопления сдвига; если не успели, следующий снимок сразу.
+        const uint64_t now_us = get_monotonic_us();
+
+        next_us += loop_ms * 1000u;
+
+        if (next_us > now_us)
+            usleep(next_us - now_us);
+        else
+            next_us = now_us;
+    }
+
+    for (size_t i = 0; i < list.count; i++)
+        drop_group(&list.items[i]);
+
+    free(list.items);
+
+    log_close();
+
+    return ((exit_code == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -1,12 +1,22 @@
 // This is a personal academic project. Dear PVS-Studio, please check it.
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 
+#include <err.h>
 #include <getopt.h>
+#include <glob.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "conf.h"
 #include "cgroup.h"
+#include "freezer.h"
+#include "group.h"
 #include "log.h"
+#include "timings.h"
+#include "utils.h"
+#include "workers.h"
 
 #define PROG_NAME ("cgctl-stop")
 
@@ -14,28 +24,145 @@ static void show_usage(void)
 {
     // clang-format off
     const char *const usage =
-        "Usage: %s [-h|--help] [-d|--debug] GROUP\n"
+        "Usage: %s [-h|--help] [-d|--debug] [-f|--freeze-timeout=MS] [-t|--timeout=MS] [-g|--grace=MS] [-s|--signal=SIG] [-j|--jobs=NUM] [-T|--timings] [-l|--log=TARGET] [-F|--log-format=FORMAT] GROUP [GROUP...]\n"
         "\t-h|--help: show this help;\n"
         "\t-d|--debug: enable debug mode;\n"
-        "\tGROUP: group name;\n"
+        "\t-f|--freeze-timeout=MS: wait for freezing the group up to MS milliseconds (2000 by default);\n"
+        "\t-t|--timeout=MS: wait for removing the group up to MS milliseconds (5000 by default);\n"
+        "\t-g|--grace=MS: send SIG to all tasks and wait up to MS milliseconds before killing them (disabled by default);\n"
+        "\t-s|--signal=SIG: signal for graceful stop (TERM by default);\n"
+        "\t-j|--jobs=NUM: remove up to NUM groups in parallel (8 by default);\n"
+        "\t-T|--timings: print durations of the removal phases summed over all groups as a JSON line to stderr;\n"
+        "\t-l|--log=TARGET: write log to syslog, stderr or a file (syslog by default);\n"
+        "\t-F|--log-format=FORMAT: log format, text, kv (key=value) or json (text by default);\n"
+        "\tGROUP: group name or shell pattern (e.g. 'web_*');\n"
     ;
     // clang-format on
 
     fprintf(stdout, usage, PROG_NAME);
 }
 
+/*
+ * \fn int destroy_group(const char *const name)
+ * \brief Задание для процесса-исполнителя: удаляет одну cgroup.
+ * \param const char *const name: Название cgroup.
+ * \return Код выхода.
+ */
+static int destroy_group(const char *const name)
+{
+    LOG_D("Removing group '%s'.", name);
+
+    return ((cgroup_destroy(name) == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*
+ * \fn bool is_pattern(const char *const arg)
+ * \brief Проверяет, является ли аргумент шаблоном названия групп.
+ * \param const char *const arg: Аргумент.
+ * \return true - если аргумент содержит спецсимволы glob(7); false - если нет.
+ */
+static bool is_pattern(const char *const arg)
+{
+    return (strpbrk(arg, "*?[") != NULL);
+}
+
+/*
+ * \fn void expand_pattern(glob_t *found, const char *const arg)
+ * \brief Раскрывает шаблон названия групп относительно основной иерархии cgroup.
+ * \param glob_t *found: Результаты раскрытия, к которым добавляются найденные каталоги.
+ * \param const char *const arg: Шаблон.
+ * \warning В случае ошибок функция завершает программу с кодом 1.
+ */
+static void expand_pattern(glob_t *found, const char *const arg)
+{
+    char pattern[MAX_FILE_PATH];
+
+    // WARN: Завершающий '/' в шаблоне оставляет в результатах только каталоги.
+    if (snprintf(pattern, sizeof(pattern), "%s/%s/", get_root_dir()->name, arg) >= (int) sizeof(pattern))
+        errx(EXIT_FAILURE, "Group pattern '%s' is too long.", arg);
+
+    const int ret = glob(pattern, ((found->gl_pathc == 0) ? 0 : GLOB_APPEND), NULL, found);
+
+    if (ret == GLOB_NOMATCH)
+        fprintf(stderr, "Warning: No groups match pattern '%s'.\n", arg);
+    else if (ret != 0)
+        errx(EXIT_FAILURE, "Unable to expand group pattern '%s'.", arg);
+}
+
+/*
+ * \fn void show_results(const worker_job_t *const jobs, const size_t count)
+ * \brief Выводит таблицу результатов удаления групп.
+ * \param const worker_job_t *const jobs: Задания.
+ * \param const size_t count: Количество заданий.
+ */
+static void show_results(const worker_job_t *const jobs, const size_t count)
+{
+    fprintf(stdout, "%-32s %-8s %10s\n", "GROUP", "STATUS", "TIME_MS");
+
+    for (size_t i = 0; i < count; i++) {
+        const worker_job_t *const job = &jobs[i];
+
+        const char *const status = ((job->status == 0) ? "ok" : ((job->status == -1) ? "crashed" : "failed"));
+
+        fprintf(stdout, "%-32s %-8s %10.1f\n", job->name, status, job->elapsed_us / 1000.0);
+    }
+}
+
+/*
+ * \fn int compare_jobs(const void *a, const void *b)
+ * \brief Сравнивает задания по названию группы для qsort(3).
+ */
+static int compare_jobs(const void *a, const void *b)
+{
+    return strcmp(((const worker_job_t *) a)->name, ((const worker_job_t *) b)->name);
+}
+
+/*
+ * \fn size_t unique_jobs(worker_job_t *jobs, const size_t count)
+ * \brief Сортирует задания по названию группы и убирает повторы.
+ * \param worker_job_t *jobs: Задания.
+ * \param const size_t count: Количество заданий, не меньше одного.
+ * \return Количество заданий без повторов.
+ * \note Одна и та же группа может быть задана явно и совпасть с шаблоном или с несколькими
+ *       шаблонами сразу, а удалять её в двух исполнителях одновременно нельзя.
+ */
+static size_t unique_jobs(worker_job_t *jobs, const size_t count)
+{
+    qsort(jobs, count, sizeof(*jobs), compare_jobs);
+
+    size_t unique = 1;
+
+    for (size_t i = 1; i < count; i++)
+        if (strcmp(jobs[i].name, jobs[unique - 1].name) != 0)
+            jobs[unique++] = jobs[i];
+
+    return unique;
+}
+
 int main(int argc, char **argv)
 {
     int opt;
     bool debug = false;
+    bool timings = false;
+    unsigned int max_jobs = STOP_JOBS;
+    int stop_signal = SIGTERM;
+    unsigned int grace_ms = 0;
 
     static struct option long_opts[] = {
         { "help", no_argument, 0, 'h' },
         { "debug", no_argument, 0, 'd' },
+        { "freeze-timeout", required_argument, 0, 'f' },
+        { "timeout", required_argument, 0, 't' },
+        { "grace", required_argument, 0, 'g' },
+        { "signal", required_argument, 0, 's' },
+        { "jobs", required_argument, 0, 'j' },
+        { "timings", no_argument, 0, 'T' },
+        { "log", required_argument, 0, 'l' },
+        { "log-format", required_argument, 0, 'F' },
         { 0, 0, 0, 0 }
     };
 
-    while ((opt = getopt_long(argc, argv, "hd", long_opts, 0)) != -1)
+    while ((opt = getopt_long(argc, argv, "hdf:t:g:s:j:Tl:F:", long_opts, 0)) != -1)
         switch (opt) {
             case 'h':
                 show_usage();
@@ -45,30 +172,141 @@ int main(int argc, char **argv)
                 debug = true;
                 break;
 
+            case 'f':
+                freezer_set_timeout(get_timeout(optarg));
+                break;
+
+            case 't':
+                cgroup_set_destroy_timeout(get_timeout(optarg));
+                break;
+
+            case 'g':
+                grace_ms = get_timeout(optarg);
+                break;
+
+            case 's':
+                stop_signal = get_signal(optarg);
+                break;
+
+            case 'j':
+                max_jobs = get_jobs(optarg);
+                break;
+
+            case 'T':
+                timings = true;
+                break;
+
+            case 'l':
+                if (log_set_target(optarg) != 0) {
+                    fprintf(stderr, "Error: Unable to open log file '%s', error '%m'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'F':
+                if (log_set_format(optarg) != 0) {
+                    fprintf(stderr, "Error: Unknown log format '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
             default:
                 fprintf(stderr, "Error: Unknown argument '%c'.\n", opt);
                 return EXIT_FAILURE;
         }
 
-    if (argc - optind != 1) {
+    if (argc - optind < 1) {
         fprintf(stderr, "Error: Group name is not defined.\n");
         return EXIT_FAILURE;
     }
 
-    const char *const group = argv[optind];
+    const size_t args_count = argc - optind;
+
+    for (size_t i = 0; i < args_count; i++)
+        if (*argv[optind + i] == '\0') {
+            fprintf(stderr, "Error: Group name is empty.\n");
+            return EXIT_FAILURE;
+        }
+
+    cgroup_set_graceful_stop(stop_signal, grace_ms);
+
+    log_open(PROG_NAME, debug);
+
+    timings_init(timings);
+
+    // Одну группу, как и раньше, удаляем прямо в текущем процессе.
+
+    if (args_count == 1 && !is_pattern(argv[optind])) {
+        const int exit_code = destroy_group(argv[optind]);
+        timings_report("stop", argv[optind], exit_code);
+        log_close();
+        return exit_code;
+    }
+
+    glob_t found = { .gl_pathc = 0, .gl_pathv = NULL };
+
+    size_t count = 0;
+
+    for (size_t i = 0; i < args_count; i++)
+        if (is_pattern(argv[optind + i]))
+            expand_pattern(&found, argv[optind + i]);
+        else
+            count++;
 
-    if (*group == '\0') {
-        fprintf(stderr, "Error: Group name is empty.\n");
+    count += found.gl_pathc;
+
+    if (count == 0) {
+        fprintf(stderr, "Error: No groups found.\n");
+        globfree(&found);
+        log_close();
         return EXIT_FAILURE;
     }
 
-    log_open(PROG_NAME, debug);
+    worker_job_t *const jobs = calloc(count, sizeof(worker_job_t));
+
+    if (jobs == NULL) {
+        LOG_C("Unable to allocate memory for jobs, error '%m'.");
+        abort();
+    }
+
+    size_t next = 0;
+
+    for (size_t i = 0; i < args_count; i++)
+        if (!is_pattern(argv[optind + i]))
+            jobs[next++].name = argv[optind + i];
+
+    const size_t root_len = strlen(get_root_dir()->name) + 1; // +1 на разделитель
+
+    for (size_t i = 0; i < found.gl_pathc; i++) {
+        char *const path = found.gl_pathv[i];
+
+        path[strlen(path) - 1] = '\0'; // убираем завершающий '/'
+
+        jobs[next++].name = path + root_len;
+    }
+
+    count = unique_jobs(jobs, count);
+
+    LOG_D("Removing %zu groups, up to %u in parallel.", count, max_jobs);
+
+    // Группы удаляем параллельно: общее время остановки определяется самой
+    // медленной группой, а не суммой по всем группам.
+
+    const size_t failed = run_workers(destroy_group, jobs, count, max_jobs);
+
+    show_results(jobs, count);
+
+    LOG_D("Removed %zu groups, %zu failed.", count - failed, failed);
+
+    // Исполнители пополняют общие счётчики, поэтому запись одна на весь запуск.
+
+    timings_report("stop", NULL, ((failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE));
 
-    LOG_D("Removing group '%s'.", group);
+    free(jobs);
 
-    cgroup_destroy(group);
+    globfree(&found);
 
     log_close();
 
-    return EXIT_SUCCESS;
+    return ((failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
 }
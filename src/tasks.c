@@ -3,152 +3,552 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include "backend.h"
+#include "group.h"
 #include "log.h"
+#include "tasks.h"
+#include "timings.h"
 #include "utils.h"
 
-// максимальный размер файла со списком pid'ов процессов в cgroup
-#define MAX_TASKS_FILE_SIZE (10485760)
+// WARN: Номера системных вызовов могут отсутствовать в заголовках старых систем,
+// сами же вызовы проверяются в рантайме (ENOSYS).
 
-// название файла с pid'ами процессов в cgroup
-static const char *const tasks_name = "tasks";
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal (424)
+#endif
 
-void kill_all_tasks(const char *const dir_path)
-{
-    int fd;
-    char *lines = NULL;
-    char file_path[MAX_FILE_PATH];
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open (434)
+#endif
 
-    format_path(file_path, dir_path, tasks_name);
+#ifndef SYS_clone3
+#define SYS_clone3 (435)
+#endif
 
-    if ((fd = open(file_path, O_RDONLY | O_CLOEXEC)) == -1) {
-        LOG_C("Unable to open tasks file '%s', error '%m'.", file_path);
-        return;
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP (0x200000000ULL)
+#endif
+
+// Список процессов (TGID) есть в обеих версиях; файл tasks в v1 перечисляет потоки,
+// и каждый процесс получал бы сигнал и занимал бы pidfd столько раз, сколько в нём потоков.
+#define PROCS_FILE ("cgroup.procs")
+
+// Аргументы clone3(2) в раскладке ядра >= 5.7, в старых заголовках нет поля cgroup.
+typedef struct
+{
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+} clone_args_t;
+
+int tasks_iter_open(tasks_iter_t *iter, const group_dir_t *const dir)
+{
+    iter->group_name = dir->name;
+    iter->pos = 0;
+    iter->len = 0;
+    iter->eof = false;
+
+    if ((iter->fd = open_file(dir, PROCS_FILE, O_RDONLY)) == -1) {
+        LOG_E("Unable to open tasks file of group '%s', error '%m'.", iter->group_name);
+        return 1;
     }
 
-    if ((lines = malloc(MAX_TASKS_FILE_SIZE + 1)) == NULL) {
-        LOG_C("Unable to allocate memory for tasks list, error '%m'.");
-        abort();
+    return 0;
+}
+
+/*
+ * \fn int next_char(tasks_iter_t *iter)
+ * \brief Возвращает очередной символ файла, при необходимости дочитывая следующую порцию.
+ * \param tasks_iter_t *iter: Итератор.
+ * \return Символ; EOF если файл закончился.
+ */
+static int next_char(tasks_iter_t *iter)
+{
+    if (iter->pos == iter->len) {
+        if (iter->eof)
+            return EOF;
+
+        ssize_t size = read(iter->fd, iter->buf, sizeof(iter->buf));
+
+        if (size == -1) {
+            LOG_E("Unable to read tasks of group '%s', error '%m'.", iter->group_name);
+            size = 0;
+        }
+
+        if (size == 0) {
+            iter->eof = true;
+            return EOF;
+        }
+
+        iter->pos = 0;
+        iter->len = size;
     }
 
+    return (unsigned char) iter->buf[iter->pos++];
+}
+
+pid_t tasks_iter_next(tasks_iter_t *iter)
+{
     /*
-     * Сначала читаем весь файл в память, а потом уже выгребаем pid-ы процессов.
-     * cgroup это псевдо файловая система, содержимое файла с pid'ами процессов
-     * меняется по мере запуска/завершения процессов и поэтому предпочитительно
-     * сперва получить полный список, а потом уже его обрабатывать.
+     * pid'ы разбираем посимвольно прямо из буфера, поэтому число может быть
+     * разрезано границей порций - накопленное значение просто переживает дочитывание.
+     * Память при этом не зависит от количества процессов в cgroup.
      */
 
-    const ssize_t size = read(fd, lines, MAX_TASKS_FILE_SIZE);
+    for (;;) {
+        int ch;
+        bool valid = true;
+        size_t digits = 0;
+        uint64_t value = 0;
+
+        while ((ch = next_char(iter)) != EOF && ch != '\n') {
+            if (ch < '0' || ch > '9' || digits >= MAX_UINT64_STR_SIZE / 2) {
+                valid = false;
+                continue;
+            }
+
+            value = value * 10 + (ch - '0');
+            digits++;
+        }
+
+        if (digits != 0) {
+            if (valid && value > 1)
+                return value;
+
+            LOG_E("Wrong pid value %" PRIu64 " in group '%s'.", value, iter->group_name);
+        }
 
-    if (size == -1) {
-        LOG_E("Unable to read tasks, error '%m'.");
-        goto on_error;
+        if (ch == EOF)
+            return 0;
     }
+}
 
-    if (size == 0) {
-        LOG_D("All tasks are already stopped, nothing to kill.");
-        goto on_error;
+void tasks_iter_close(tasks_iter_t *iter)
+{
+    if (close(iter->fd) == -1) {
+        LOG_C("Unable to close tasks file of group '%s', error '%m'.", iter->group_name);
+        abort();
     }
 
+    iter->fd = -1;
+}
+
+/*
+ * \fn int open_pidfd(const pid_t pid)
+ * \brief Получает pidfd процесса.
+ * \param const pid_t pid: pid процесса.
+ * \return pidfd процесса; -1 если процесс уже завершился или ядро не поддерживает pidfd.
+ */
+static int open_pidfd(const pid_t pid)
+{
+    static bool supported = true;
+
+    if (!supported)
+        return -1;
+
+    const int fd = syscall(SYS_pidfd_open, pid, 0);
+
+    // EINVAL означает, что pid не лидера группы потоков: ему, как и при ENOSYS, хватит kill(2).
+
+    if (fd == -1) {
+        if (errno == ENOSYS) {
+            LOG_D("Syscall pidfd_open() is not supported by kernel, falling back to kill().");
+            supported = false;
+        } else if (errno != ESRCH && errno != EINVAL)
+            LOG_E("Unable to open pidfd of pid %u, error '%m'.", pid);
+    }
+
+    return fd;
+}
+
+/*
+ * \fn int kill_task(const pid_t pid, tasks_set_t *set)
+ * \brief Прибивает процесс сигналом SIGKILL, по возможности через pidfd.
+ * \param const pid_t pid: pid процесса.
+ * \param tasks_set_t *set: Набор pidfd или NULL.
+ * \return -1 в случае ошибки; 0 если сигнал отправлен.
+ */
+static int kill_task(const pid_t pid, tasks_set_t *set)
+{
     /*
-     * WARN: прочитав максимально возможное количество байтов, пробуем прочитать ещё,
-     * и если это ещё не всё (файл не закончился), то падаем, потому что ситуация
-     * критическая - что-то пошло совсем не так и всё очень плохо.
+     * Процессы в cgroup заморожены и не могут завершиться, поэтому pid из cgroup.procs
+     * гарантированно принадлежит именно им. Полученный pidfd закрепляет процесс за нами:
+     * сигнал уйдёт именно ему, даже если pid будет переиспользован, а по poll(2)
+     * на pidfd можно точно узнать момент его завершения.
      */
 
-    char tmp;
+    if (set != NULL && set->count < MAX_PIDFDS) {
+        const int fd = open_pidfd(pid);
 
-    if (read(fd, &tmp, 1) == 1) {
-        LOG_C("Tasks file is too big.");
-        abort();
+        if (fd != -1) {
+            if (syscall(SYS_pidfd_send_signal, fd, SIGKILL, NULL, 0) == -1) {
+                if (close(fd) == -1) {
+                    LOG_C("Unable to close pidfd of pid %u, error '%m'.", pid);
+                    abort();
+                }
+                return -1;
+            }
+
+            set->fds[set->count++] = fd;
+            return 0;
+        }
     }
 
-    lines[size] = '\0';
+    return kill(pid, SIGKILL);
+}
 
-    for (const char *line = strtok(lines, "\n"); line != NULL; line = strtok(NULL, "\n")) {
-        const pid_t pid = str2uint(line);
+void kill_all_tasks(const group_dir_t *const dir, tasks_set_t *set)
+{
+    pid_t pid;
+    size_t count = 0;
+    size_t killed = 0;
+    size_t exited = 0;
+    tasks_iter_t iter;
 
-        if (pid <= 1) {
-            LOG_C("Wrong pid value %u ('%s').", pid, line);
-            continue;
-        }
+    if (tasks_iter_open(&iter, dir) != 0)
+        return;
+
+    const uint64_t start_us = timing_start();
 
-        LOG_D("Going to kill task with pid %u in '%s'.", pid, file_path);
+    /*
+     * Файл читаем порциями, сразу же посылая сигналы. Процессы в cgroup заморожены,
+     * поэтому список не меняется в процессе чтения, а значит не нужно предварительно
+     * вычитывать его в память целиком.
+     */
+
+    // WARN: Записи лога по каждому pid не пишем, только считаем: при тысячах процессов
+    // отладочный режим иначе замедляет остановку больше, чем сама остановка.
+
+    while ((pid = tasks_iter_next(&iter)) != 0) {
+        count++;
 
         // Добиваем процесс сигналом SIGKILL.
 
-        if (kill(pid, SIGKILL) == 0) {
-            LOG_D("Task with pid %u has been killed successfully.", pid);
+        if (kill_task(pid, set) == 0) {
+            killed++;
+
+            if (set != NULL)
+                set->killed++;
+
             continue;
         }
 
         if (errno == ESRCH)
-            LOG_D("Pid %u is already exited while sending SIGKILL.", pid);
+            exited++;
         else
             LOG_E("Unable to send SIGKILL to pid %u, error '%m'.", pid);
     }
 
-    LOG_D("All found tasks have been killed.");
+    timing_count(COUNTER_KILLED, killed);
+
+    if (count == 0)
+        LOG_D("All tasks are already stopped, nothing to kill.");
+    else
+        LOG_D("Found %zu tasks in group '%s': %zu killed, %zu already exited.", count, dir->name, killed, exited);
+
+    tasks_iter_close(&iter);
+
+    timing_stop(TIMING_KILL, start_us);
+}
+
+size_t signal_all_tasks(const group_dir_t *const dir, const int signal)
+{
+    pid_t pid;
+    size_t count = 0;
+    tasks_iter_t iter;
+
+    if (tasks_iter_open(&iter, dir) != 0)
+        return 0;
+
+    while ((pid = tasks_iter_next(&iter)) != 0) {
+        if (kill(pid, signal) == 0) {
+            count++;
+            continue;
+        }
+
+        if (errno != ESRCH)
+            LOG_E("Unable to send signal %d to pid %u, error '%m'.", signal, pid);
+    }
+
+    tasks_iter_close(&iter);
 
-on_error:
+    if (signal != 0)
+        LOG_D("Signal %d has been sent to %zu tasks in group '%s'.", signal, count, dir->name);
 
-    free(lines);
+    return count;
+}
+
+int wait_all_tasks(tasks_set_t *set, const unsigned int timeout_ms)
+{
+    struct pollfd pfds[MAX_PIDFDS];
+
+    if (set->count == 0)
+        return 0;
+
+    const uint64_t start_us = get_monotonic_us();
+    const uint64_t deadline_us = start_us + (uint64_t) timeout_ms * 1000;
+    const size_t total = set->count;
+
+    while (set->count != 0) {
+        const uint64_t now_us = get_monotonic_us();
+
+        if (now_us >= deadline_us) {
+            LOG_E("%zu of %zu killed tasks have not exited in %u ms.", set->count, total, timeout_ms);
+            break;
+        }
+
+        for (size_t i = 0; i < set->count; i++) {
+            pfds[i].fd = set->fds[i];
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+
+        const int ready = poll(pfds, set->count, (deadline_us - now_us + 999) / 1000);
+
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+
+            LOG_C("Unable to poll pidfds, error '%m'.");
+            abort();
+        }
+
+        // Закрываем pidfd завершившихся процессов, оставляя в наборе только живые.
+
+        size_t alive = 0;
+
+        for (size_t i = 0; i < set->count; i++) {
+            if (pfds[i].revents == 0) {
+                set->fds[alive++] = set->fds[i];
+                continue;
+            }
+
+            if (close(pfds[i].fd) == -1) {
+                LOG_C("Unable to close pidfd, error '%m'.");
+                abort();
+            }
+        }
+
+        set->count = alive;
+    }
+
+    LOG_I("%zu of %zu killed tasks exited in %" PRIu64 " us.", total - set->count, total, get_monotonic_us() - start_us);
+
+    // Оставшиеся pidfd больше не нужны: процессы будут прибиты снова в следующем раунде.
+
+    for (size_t i = 0; i < set->count; i++)
+        if (close(set->fds[i]) == -1) {
+            LOG_C("Unable to close pidfd, error '%m'.");
+            abort();
+        }
+
+    const int exit_code = ((set->count == 0) ? 0 : 1);
+
+    set->count = 0;
+
+    return exit_code;
+}
+
+int kill_group(const group_dir_t *const dir)
+{
+    const int fd = open_file(dir, "cgroup.kill", O_WRONLY);
+
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            LOG_D("File cgroup.kill is not supported by kernel, falling back to per-task kill.");
+            return 1;
+        }
+
+        LOG_C("Unable to open cgroup.kill of group '%s', error '%m'.", dir->name);
+        abort();
+    }
+
+    LOG_D("Killing all tasks in group '%s' via cgroup.kill.", dir->name);
+
+    if (write(fd, "1\n", 2) != 2) {
+        LOG_C("Unable to write to cgroup.kill of group '%s', error '%m'.", dir->name);
+        abort();
+    }
 
     if (close(fd) == -1) {
-        LOG_E("Unable to close tasks file '%s', error '%m'.", file_path);
+        LOG_C("Unable to close cgroup.kill of group '%s', error '%m'.", dir->name);
         abort();
     }
+
+    return 0;
 }
 
-void save_pid2tasks(const char *const dir_path)
+size_t reap_children(void)
+{
+    size_t count = 0;
+
+    for (;;) {
+        siginfo_t info;
+
+        info.si_pid = 0;
+
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG) == -1) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != ECHILD)
+                LOG_E("Unable to reap child processes, error '%m'.");
+
+            break;
+        }
+
+        if (info.si_pid == 0)
+            break; // живые потомки есть, но завершившихся больше нет
+
+        LOG_D("Orphaned process %u has been reaped.", info.si_pid);
+
+        count++;
+    }
+
+    return count;
+}
+
+void save_pid2tasks(const group_dir_t *const dir)
 {
     const pid_t pid = getpid();
 
-    LOG_D("Adding current pid %u to group '%s'.", pid, dir_path);
+    LOG_D("Adding current pid %u to group '%s'.", pid, dir->name);
+
+    // WARN: На v1 с раздельно смонтированными контроллерами процесс нужно поместить
+    // в cgroup каждой иерархии, иначе ограничения части контроллеров к нему не применятся.
 
-    if (write_num(pid, dir_path, tasks_name) != 0) {
+    if (write_num_all(pid, dir, get_backend()->procs_file) != 0) {
         LOG_C("Unable to save pid %u to tasks.", pid);
         abort();
     }
 }
 
-bool are_alive_tasks_exist(const char *const dir_path)
+bool are_alive_tasks_exist(const group_dir_t *const dir)
 {
-    char file_path[MAX_FILE_PATH];
+    tasks_iter_t iter;
 
-    format_path(file_path, dir_path, tasks_name);
+    if (tasks_iter_open(&iter, dir) != 0) {
+        LOG_C("Unable to check tasks in cgroup '%s'.", dir->name);
+        abort();
+    }
 
-    const int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    const bool result = (tasks_iter_next(&iter) != 0);
 
-    if (fd == -1) {
-        LOG_C("Unable to open tasks file '%s', error '%m'.", file_path);
-        abort();
+    tasks_iter_close(&iter);
+
+    LOG_D("%s alive tasks have been found in cgroup '%s'.", ((result) ? "A few" : "No"), dir->name);
+
+    return result;
+}
+
+ssize_t count_tasks(group_dir_t *dir)
+{
+    char buf[TASKS_CHUNK_SIZE];
+    ssize_t count = 0;
+
+    // WARN: v1 кеширует список pid'ов в открытом файле, пока его перечитывают чаще раза
+    // в секунду (см. tasks_iter_open()), поэтому там файл по-прежнему открывается заново.
+
+    if (get_backend()->version == 1) {
+        tasks_iter_t iter;
+
+        if (tasks_iter_open(&iter, dir) != 0)
+            return -1;
+
+        while (tasks_iter_next(&iter) != 0)
+            count++;
+
+        tasks_iter_close(&iter);
+
+        return count;
     }
 
-    char tmp;
+    const int fd = group_file(dir, GROUP_FILE_PROCS);
 
-    const ssize_t size = read(fd, &tmp, 1);
+    if (fd == -1)
+        return -1;
 
-    if (size == -1) {
-        LOG_C("Unable to read from tasks file '%s', error '%m'.", file_path);
-        abort();
+    // По одному pid'у в строке: разбирать числа не нужно, достаточно считать переводы строк.
+
+    for (off_t offset = 0;;) {
+        const ssize_t size = pread(fd, buf, sizeof(buf), offset);
+
+        if (size == -1) {
+            LOG_E("Unable to read tasks of group '%s', error '%m'.", dir->name);
+            return -1;
+        }
+
+        if (size == 0)
+            return count;
+
+        for (ssize_t i = 0; i < size; i++)
+            count += (buf[i] == '\n');
+
+        offset += size;
     }
+}
 
-    if (close(fd) == -1) {
-        LOG_C("Unable to close tasks file '%s', error '%m'.", file_path);
-        abort();
+pid_t fork_into_group(const group_dir_t *const dir)
+{
+    static bool supported = true;
+
+    /*
+     * Процесс, созданный через clone3(CLONE_INTO_CGROUP), рождается сразу в нужной cgroup:
+     * не нужно ни записи в cgroup.procs, ни миграции памяти и потоков из родительской cgroup.
+     * Без флагов CLONE_VM и стека clone3(2) ведёт себя как обычный fork(2).
+     */
+
+    if (supported && get_backend()->version == 2) {
+        log_flush();
+
+        clone_args_t args = {
+            .flags = CLONE_INTO_CGROUP,
+            .exit_signal = SIGCHLD,
+            .cgroup = dir->fds[0]
+        };
+
+        const pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+
+        if (pid != -1)
+            return pid;
+
+        // ENOSYS - ядро < 5.3, E2BIG/EINVAL - ядро < 5.7 без CLONE_INTO_CGROUP.
+        if (errno != ENOSYS && errno != E2BIG && errno != EINVAL) {
+            LOG_E("Unable to clone process into group '%s', error '%m'.", dir->name);
+            return -1;
+        }
+
+        LOG_D("Syscall clone3() with CLONE_INTO_CGROUP is not supported by kernel, falling back to fork().");
+        supported = false;
     }
 
-    const bool result = (size == 1);
+    log_flush();
 
-    LOG_D("%s alive tasks have been found in cgroup '%s'.", ((result) ? "A few" : "No"), dir_path);
+    const pid_t pid = fork();
 
-    return result;
+    // Дочерний процесс переносит в cgroup только себя, родитель остаётся на месте.
+    if (pid == 0)
+        save_pid2tasks(dir);
+
+    return pid;
 }
@@ -2,28 +2,140 @@
 #define SRC_TASKS_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "group.h"
+
+// размер буфера, которым читается файл со списком pid'ов процессов в cgroup
+#define TASKS_CHUNK_SIZE (4096)
+
+// максимальное количество процессов, завершение которых отслеживается через pidfd
+#define MAX_PIDFDS (1024)
+
+typedef struct
+{
+    size_t count; // количество открытых pidfd
+    size_t killed; // количество процессов, которым отправлен SIGKILL
+    int fds[MAX_PIDFDS]; // pidfd прибитых процессов
+} tasks_set_t;
+
+typedef struct
+{
+    int fd; // открытый файл со списком pid'ов
+    size_t pos; // позиция следующего непрочитанного символа в буфере
+    size_t len; // количество прочитанных в буфер символов
+    bool eof; // файл прочитан до конца
+    char buf[TASKS_CHUNK_SIZE]; // буфер для очередной порции файла
+    const char *group_name; // название cgroup для сообщений
+} tasks_iter_t;
+
+/*
+ * \fn int tasks_iter_open(tasks_iter_t *iter, const group_dir_t *const dir)
+ * \brief Открывает файл со списком pid'ов процессов (cgroup.procs) для последовательного чтения.
+ * \note В обеих версиях перечисляются процессы, а не потоки: в v1 это TGID без повторов.
+ * \param tasks_iter_t *iter: Итератор.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \return 1 в случае ошибки; 0 если файл открыт успешно.
+ * \note Файл открывается заново при каждом обходе: в v1 ядро кеширует список pid'ов
+ *       в открытом файле, и перечитывание того же дескриптора вернуло бы старый список.
+ */
+int tasks_iter_open(tasks_iter_t *iter, const group_dir_t *const dir);
 
 /*
- * \fn void kill_all_tasks(const char *const dir_path)
+ * \fn pid_t tasks_iter_next(tasks_iter_t *iter)
+ * \brief Возвращает очередной pid из файла, читая его порциями фиксированного размера.
+ * \param tasks_iter_t *iter: Итератор.
+ * \return Значение pid; 0 если pid'ы закончились.
+ */
+pid_t tasks_iter_next(tasks_iter_t *iter);
+
+/*
+ * \fn void tasks_iter_close(tasks_iter_t *iter)
+ * \brief Закрывает файл итератора.
+ * \param tasks_iter_t *iter: Итератор.
+ */
+void tasks_iter_close(tasks_iter_t *iter);
+
+/*
+ * \fn void kill_all_tasks(const group_dir_t *const dir, tasks_set_t *set)
  * \brief Прибивает все дочерние процессы, оставшиеся после завершения главного процесса.
- * \param const char *const dir_path: Путь к каталогу cgroup.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param tasks_set_t *set: Набор, в который сохраняются pidfd прибитых процессов, или NULL.
+ *        Если ядро не поддерживает pidfd или набор заполнен, процессы прибиваются по pid.
  * \warning Функция должна вызываться только когда cgroup "заморожен".
  */
-void kill_all_tasks(const char *const dir_path);
+void kill_all_tasks(const group_dir_t *const dir, tasks_set_t *set);
+
+/*
+ * \fn size_t signal_all_tasks(const group_dir_t *const dir, const int signal)
+ * \brief Посылает сигнал всем процессам в cgroup (без учёта потомков).
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param const int signal: Сигнал; 0 - просто посчитать живые процессы.
+ * \return Количество процессов, которым удалось отправить сигнал.
+ */
+size_t signal_all_tasks(const group_dir_t *const dir, const int signal);
+
+/*
+ * \fn int wait_all_tasks(tasks_set_t *set, const unsigned int timeout_ms)
+ * \brief Дожидается завершения всех процессов из набора и закрывает их pidfd.
+ * \param tasks_set_t *set: Набор pidfd, заполненный kill_all_tasks().
+ * \param const unsigned int timeout_ms: Таймаут ожидания, миллисекунд.
+ * \return 1 если какие-то процессы не завершились за отведённое время; 0 если всё хорошо.
+ * \warning Функция должна вызываться только когда cgroup "разморожен", иначе процессы не смогут завершиться.
+ */
+int wait_all_tasks(tasks_set_t *set, const unsigned int timeout_ms);
+
+/*
+ * \fn int kill_group(const group_dir_t *const dir)
+ * \brief Прибивает все процессы в cgroup и её потомках одной записью в cgroup.kill (ядро >= 5.14).
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \return 1 если ядро не поддерживает cgroup.kill; 0 если сигнал отправлен.
+ * \note В отличие от kill_all_tasks() не требует заморозки cgroup: ядро само не даёт
+ *       процессам уйти от сигнала через fork(2).
+ */
+int kill_group(const group_dir_t *const dir);
+
+/*
+ * \fn size_t reap_children(void)
+ * \brief Подбирает всех завершившихся дочерних процессов (зомби), не дожидаясь остальных.
+ * \return Количество подобранных процессов.
+ */
+size_t reap_children(void);
 
 /*
- * \fn void save_pid2tasks(const char *const dir_path)
+ * \fn void save_pid2tasks(const group_dir_t *const dir)
  * \brief Добавляет текущий процесс в созданный cgroup.
- * \param const char *const dir_path: Путь к каталогу cgroup.
+ * \param const group_dir_t *const dir: Каталог cgroup.
  */
-void save_pid2tasks(const char *const dir_path);
+void save_pid2tasks(const group_dir_t *const dir);
 
 /*
- * \fn bool are_alive_tasks_exist(const char *const dir_path)
+ * \fn bool are_alive_tasks_exist(const group_dir_t *const dir)
  * \brief Проверяет, есть ли в заданном cgroup хотя бы один процесс.
- * \param const char *const dir_path: Путь к каталогу cgroup.
+ * \param const group_dir_t *const dir: Каталог cgroup.
  * \return true - если в cgroup есть хотя бы один процесс; false - если нет.
  */
-bool are_alive_tasks_exist(const char *const dir_path);
+bool are_alive_tasks_exist(const group_dir_t *const dir);
+
+/*
+ * \fn ssize_t count_tasks(group_dir_t *dir)
+ * \brief Считает процессы в cgroup (без вложенных cgroup).
+ * \param group_dir_t *dir: Каталог cgroup, на v2 cgroup.procs остаётся в нём открытым.
+ * \return Количество процессов (не потоков) в обеих версиях; -1 в случае ошибки.
+ */
+ssize_t count_tasks(group_dir_t *dir);
+
+/*
+ * \fn pid_t fork_into_group(const group_dir_t *const dir)
+ * \brief Создаёт дочерний процесс, который с самого начала находится в заданной cgroup.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \return Как у fork(2): pid дочернего процесса в родителе, 0 в дочернем, -1 в случае ошибки.
+ * \warning Процесс, созданный через clone3(2) в обход glibc, наследует закешированный TID
+ *          родителя, и обработчики pthread_atfork(3) в нём не выполняются. Поэтому до execv(2)
+ *          дочерний процесс может вызывать только async-signal-safe функции и завершаться
+ *          через _exit(2), но не через abort(3) или exit(3).
+ */
+pid_t fork_into_group(const group_dir_t *const dir);
 
 #endif /* SRC_TASKS_H_ */
@@ -0,0 +1,140 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "timings.h"
+#include "utils.h"
+
+typedef struct
+{
+    uint64_t phases[TIMINGS_COUNT]; // время фаз, микросекунд
+    uint64_t counters[COUNTERS_COUNT];
+} timings_t;
+
+// clang-format off
+static const char *const phase_names[TIMINGS_COUNT] = {
+    [TIMING_MKDIR] = "mkdir_us",
+    [TIMING_CPUSET] = "cpuset_us",
+    [TIMING_LIMITS] = "limits_us",
+    [TIMING_GRACE] = "grace_us",
+    [TIMING_FREEZE] = "freeze_us",
+    [TIMING_KILL] = "kill_us",
+    [TIMING_WAIT] = "wait_us",
+    [TIMING_RMDIR] = "rmdir_us"
+};
+
+static const char *const counter_names[COUNTERS_COUNT] = {
+    [COUNTER_GROUPS] = "groups",
+    [COUNTER_ATTEMPTS] = "attempts",
+    [COUNTER_FREEZES] = "freezes",
+    [COUNTER_KILLED] = "killed",
+    [COUNTER_RMDIR_BUSY] = "rmdir_busy"
+};
+// clang-format on
+
+static timings_t *timings = NULL; // NULL - сбор выключен
+static uint64_t started_us = 0;
+static bool json_output = false;
+
+void timings_init(const bool json)
+{
+    // WARN: Память разделяемая, а не просто статическая: cgroup удаляются в процессах-исполнителях
+    // (см. run_workers()), и их вклад иначе пропал бы вместе с ними.
+
+    void *const addr = mmap(NULL, sizeof(timings_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (addr == MAP_FAILED) {
+        LOG_C("Unable to allocate shared memory for timings, error '%m'.");
+        abort();
+    }
+
+    timings = addr; // mmap(2) возвращает обнулённую память
+    started_us = get_monotonic_us();
+    json_output = json;
+}
+
+uint64_t timing_start(void)
+{
+    return ((timings == NULL) ? 0 : get_monotonic_us());
+}
+
+void timing_stop(const timing_phase_t phase, const uint64_t start_us)
+{
+    if (timings != NULL)
+        __atomic_add_fetch(&timings->phases[phase], get_monotonic_us() - start_us, __ATOMIC_RELAXED);
+}
+
+void timing_count(const timing_counter_t counter, const size_t value)
+{
+    if (timings != NULL)
+        __atomic_add_fetch(&timings->counters[counter], value, __ATOMIC_RELAXED);
+}
+
+/*
+ * \fn void append_field(char *buf, const size_t size, size_t *len, const char *const key, const uint64_t value)
+ * \brief Дописывает в запись поле key=value.
+ * \param char *buf: Буфер записи.
+ * \param const size_t size: Размер буфера.
+ * \param size_t *len: Текущая длина записи, увеличивается на длину поля.
+ * \param const char *const key: Название поля.
+ * \param const uint64_t value: Значение поля.
+ */
+static void append_field(char *buf, const size_t size, size_t *len, const char *const key, const uint64_t value)
+{
+    const int ret = snprintf(buf + *len, size - *len, " %s=%" PRIu64, key, value);
+
+    if (ret > 0 && (size_t) ret < size - *len)
+        *len += ret;
+}
+
+void timings_report(const char *const op, const char *const group, const int exit_code)
+{
+    char buf[512];
+    size_t len = 0;
+
+    if (timings == NULL)
+        return;
+
+    const uint64_t total_us = get_monotonic_us() - started_us;
+
+    const int ret = snprintf(buf, sizeof(buf), "op=%s group=%s exit_code=%d", op, ((group == NULL) ? "-" : group), exit_code);
+
+    if (ret > 0)
+        len = (((size_t) ret < sizeof(buf)) ? (size_t) ret : sizeof(buf) - 1);
+
+    append_field(buf, sizeof(buf), &len, "total_us", total_us);
+
+    for (size_t i = 0; i < TIMINGS_COUNT; i++)
+        append_field(buf, sizeof(buf), &len, phase_names[i], timings->phases[i]);
+
+    for (size_t i = 0; i < COUNTERS_COUNT; i++)
+        append_field(buf, sizeof(buf), &len, counter_names[i], timings->counters[i]);
+
+    LOG_I("%s", buf);
+
+    if (!json_output)
+        return;
+
+    fprintf(stderr, "{\"op\":");
+    print_json_string(stderr, op);
+
+    if (group != NULL) {
+        fprintf(stderr, ",\"group\":");
+        print_json_string(stderr, group);
+    }
+
+    fprintf(stderr, ",\"exit_code\":%d,\"total_us\":%" PRIu64, exit_code, total_us);
+
+    for (size_t i = 0; i < TIMINGS_COUNT; i++)
+        fprintf(stderr, ",\"%s\":%" PRIu64, phase_names[i], timings->phases[i]);
+
+    for (size_t i = 0; i < COUNTERS_COUNT; i++)
+        fprintf(stderr, ",\"%s\":%" PRIu64, counter_names[i], timings->counters[i]);
+
+    fprintf(stderr, "}\n");
+}
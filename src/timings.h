@@ -0,0 +1,79 @@
+#ifndef SRC_TIMINGS_H_
+#define SRC_TIMINGS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Фазы создания и удаления cgroup, время которых суммируется за весь запуск утилиты.
+ * Фазы не вложены друг в друга, но cgctl-stop удаляет несколько cgroup параллельно,
+ * поэтому сумма фаз может превышать общее время.
+ */
+typedef enum
+{
+    TIMING_MKDIR = 0, // создание каталога cgroup
+    TIMING_CPUSET, // инициализация cgroup: cpuset.cpus и cpuset.mems
+    TIMING_LIMITS, // запись ограничений
+    TIMING_GRACE, // мягкая остановка: сигнал и ожидание опустения cgroup
+    TIMING_FREEZE, // заморозка и разморозка вместе с ожиданием смены состояния
+    TIMING_KILL, // отправка SIGKILL (обход tasks или cgroup.kill)
+    TIMING_WAIT, // ожидание завершения прибитых процессов через pidfd
+    TIMING_RMDIR, // ожидание опустения cgroup и удаление каталога, включая повторы
+    TIMINGS_COUNT
+} timing_phase_t;
+
+typedef enum
+{
+    COUNTER_GROUPS = 0, // созданий и опустошений cgroup (перезапуск - это два)
+    COUNTER_ATTEMPTS, // раундов прибивания процессов
+    COUNTER_FREEZES, // заморозок и разморозок
+    COUNTER_KILLED, // процессов, которым отправлен SIGKILL
+    COUNTER_RMDIR_BUSY, // отказов rmdir(2) с EBUSY
+    COUNTERS_COUNT
+} timing_counter_t;
+
+/*
+ * \fn void timings_init(const bool json)
+ * \brief Включает сбор времени фаз и счётчиков до вызова timings_report().
+ * \param const bool json: Дополнительно выводить отчёт строкой JSON в stderr.
+ * \note Счётчики живут в разделяемой памяти, поэтому процессы-исполнители, запущенные
+ *       через fork(2), пополняют их же. Без вызова timings_init() сбор выключен.
+ * \warning В случае ошибок вызывает функцию abort().
+ */
+void timings_init(const bool json);
+
+/*
+ * \fn uint64_t timing_start(void)
+ * \brief Засекает начало фазы.
+ * \return Время начала, микросекунд; 0 если сбор выключен.
+ */
+uint64_t timing_start(void);
+
+/*
+ * \fn void timing_stop(const timing_phase_t phase, const uint64_t start_us)
+ * \brief Добавляет к фазе время, прошедшее с её начала.
+ * \param const timing_phase_t phase: Фаза.
+ * \param const uint64_t start_us: Время начала из timing_start().
+ */
+void timing_stop(const timing_phase_t phase, const uint64_t start_us);
+
+/*
+ * \fn void timing_count(const timing_counter_t counter, const size_t value)
+ * \brief Увеличивает счётчик.
+ * \param const timing_counter_t counter: Счётчик.
+ * \param const size_t value: Приращение.
+ */
+void timing_count(const timing_counter_t counter, const size_t value);
+
+/*
+ * \fn void timings_report(const char *const op, const char *const group, const int exit_code)
+ * \brief Выводит одну итоговую запись о времени фаз и счётчиках за весь запуск.
+ * \param const char *const op: Действие (start, stop, restart и т.п.).
+ * \param const char *const group: Название cgroup; NULL - если их несколько.
+ * \param const int exit_code: Код выхода утилиты.
+ * \note Запись пишется в syslog в виде key=value, а при timings_init(true) ещё и в stderr в виде JSON.
+ */
+void timings_report(const char *const op, const char *const group, const int exit_code);
+
+#endif /* SRC_TIMINGS_H_ */
@@ -8,11 +8,17 @@
 #include <inttypes.h>
 #include <libgen.h>
 #include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+#include <sys/sysmacros.h>
 
 #include "log.h"
 #include "utils.h"
@@ -35,6 +41,24 @@ uint64_t str2uint(const char *const value)
         return 0; // Ошибка.
 }
 
+uint64_t get_key_value(const char *const buf, const char *const key)
+{
+    const size_t len = strlen(key);
+
+    for (const char *line = buf; *line != '\0';) {
+        // Ключ сравниваем целиком, чтобы "rss" не нашёлся в "rss_huge".
+        if (strncmp(line, key, len) == 0 && line[len] == ' ')
+            return str2uint(line + len + 1);
+
+        line += strcspn(line, "\n");
+
+        if (*line == '\n')
+            line++;
+    }
+
+    return 0;
+}
+
 unsigned int get_cpu_usage(const char *const value)
 {
     const unsigned int ret = str2uint(value);
@@ -55,79 +79,432 @@ unsigned int get_mem_usage(const char *const value)
     return ret;
 }
 
-void format_path(char *file_path, const char *const dir_path, const char *const entry_name)
+/*
+ * \fn uint64_t str2size(const char *const value)
+ * \brief Конвертирует строку с числом и необязательным суффиксом K, M или G.
+ * \param const char *const value: Строка с числом.
+ * \return Значение числа с учётом суффикса; 0 в случае ошибок.
+ */
+static uint64_t str2size(const char *const value)
 {
-    if (snprintf(file_path, MAX_FILE_PATH, "%s/%s", dir_path, entry_name) <= 1) {
-        LOG_C("Unable to format path from '%s'/'%s', error '%m'.", dir_path, entry_name);
-        abort();
+    char buf[MAX_UINT64_STR_SIZE];
+    unsigned int shift = 0;
+    size_t size = strlen(value);
+
+    if (size == 0 || size >= sizeof(buf))
+        return 0;
+
+    memcpy(buf, value, size + 1);
+
+    switch (buf[size - 1]) {
+        case 'K':
+        case 'k':
+            shift = 10;
+            break;
+
+        case 'M':
+        case 'm':
+            shift = 20;
+            break;
+
+        case 'G':
+        case 'g':
+            shift = 30;
+            break;
     }
+
+    if (shift != 0)
+        buf[--size] = '\0';
+
+    const uint64_t ret = str2uint(buf);
+
+    if (ret > (UINT64_MAX >> (shift + 1)))
+        return 0;
+
+    return ret << shift;
 }
 
-int read_num(uint64_t *out_value, const char *const dir_path, const char *const file_name)
+uint64_t get_mem_size(const char *const value)
 {
-    char file_path[MAX_FILE_PATH];
+    char buf[MAX_UINT64_STR_SIZE];
+    const size_t size = strlen(value);
 
-    format_path(file_path, dir_path, file_name);
+    if (size == 0 || size >= sizeof(buf))
+        errx(EXIT_FAILURE, "Invalid memory size value '%s'.", value);
 
-    FILE *const fp = fopen(file_path, "re");
+    // Проценты считаем от всей оперативной памяти системы.
 
-    if (fp == NULL) {
-        LOG_E("Unable to open file '%s', error '%m'.", file_path);
-        return 1;
+    if (value[size - 1] == '%') {
+        struct sysinfo info;
+
+        memcpy(buf, value, size - 1);
+        buf[size - 1] = '\0';
+
+        const uint64_t percent = str2uint(buf);
+
+        if (percent < 1 || percent > 100)
+            errx(EXIT_FAILURE, "Invalid memory size percent value '%s', must be in [1..100]%%.", value);
+
+        if (sysinfo(&info) == -1)
+            err(EXIT_FAILURE, "Unable to get system information");
+
+        return ((uint64_t) info.totalram * info.mem_unit * percent) / 100;
     }
 
-    setbuf(fp, NULL);
+    const uint64_t ret = str2size(value);
+
+    if (ret == 0)
+        errx(EXIT_FAILURE, "Invalid memory size value '%s', must be NUM%% or bytes with K, M or G suffix.", value);
 
-    int exit_code = 1;
+    return ret;
+}
+
+unsigned int get_cpu_quota(const char *const value)
+{
     char buf[MAX_UINT64_STR_SIZE];
+    const int cpu_count = get_nprocs();
+    const size_t size = strlen(value);
+
+    if (size == 0 || size >= sizeof(buf))
+        errx(EXIT_FAILURE, "Invalid CPU quota value '%s'.", value);
 
-    if (fgets(buf, sizeof(buf), fp) == NULL) {
-        LOG_E("Unable to read line from file '%s', error '%m'.", file_path);
+    // Проценты считаем от всех ядер системы.
 
-    } else {
-        *out_value = str2uint(buf);
-        LOG_D("Got value %" PRIu64 " from '%s'.", *out_value, file_path);
-        exit_code = 0;
+    if (value[size - 1] == '%') {
+        memcpy(buf, value, size - 1);
+        buf[size - 1] = '\0';
+
+        const uint64_t percent = str2uint(buf);
+
+        if (percent < 1 || percent > 100)
+            errx(EXIT_FAILURE, "Invalid CPU quota percent value '%s', must be in [1..100]%%.", value);
+
+        return (cpu_count * 1000 * percent) / 100;
     }
 
-    if (fclose(fp) == EOF) {
-        LOG_C("Unable to close file '%s', error '%m'.", file_path);
-        abort();
+    // Количество ядер может быть дробным, точность - тысячная доля ядра.
+
+    uint64_t cores = 0;
+    unsigned int scale = 1000;
+    bool fraction = false;
+
+    for (const char *ch = value; *ch != '\0'; ch++) {
+        if (*ch == '.' && !fraction) {
+            fraction = true;
+            continue;
+        }
+
+        if (*ch < '0' || *ch > '9' || (fraction && scale == 1))
+            errx(EXIT_FAILURE, "Invalid CPU quota value '%s', must be NUM%% or cores count.", value);
+
+        if (fraction) {
+            scale /= 10;
+            cores += (*ch - '0') * scale;
+        } else
+            cores = cores * 10 + (*ch - '0') * 1000;
+
+        if (cores > (uint64_t) cpu_count * 1000)
+            break;
     }
 
-    return exit_code;
+    if (cores < 1 || cores > (uint64_t) cpu_count * 1000)
+        errx(EXIT_FAILURE, "Invalid CPU quota value '%s', must be in (0..%d] cores.", value, cpu_count);
+
+    return cores;
 }
 
-int write_num(const uint64_t value, const char *const dir_path, const char *const file_name)
+unsigned int get_cpu_period(const char *const value)
 {
-    char file_path[MAX_FILE_PATH];
+    const uint64_t ret = str2uint(value);
+
+    // Ограничения ядра: от 1 мс до 1 с.
+    if (ret < 1000 || ret > 1000000)
+        errx(EXIT_FAILURE, "Invalid CPU period value '%s', must be in [1000..1000000] us.", value);
+
+    return ret;
+}
 
-    format_path(file_path, dir_path, file_name);
+char *get_cpu_list(char *value)
+{
+    bool digit = false; // предыдущий символ - цифра
 
-    FILE *const fp = fopen(file_path, "we");
+    // WARN: В опциях cgctl запятая разделяет сами опции, поэтому разрешаем ':'.
 
-    if (fp == NULL) {
-        LOG_E("Unable to open file '%s', error '%m'.", file_path);
-        return 1;
+    for (char *ch = value; *ch != '\0'; ch++) {
+        if (*ch == ':')
+            *ch = ',';
+
+        if (*ch >= '0' && *ch <= '9') {
+            digit = true;
+            continue;
+        }
+
+        if ((*ch != ',' && *ch != '-') || !digit)
+            errx(EXIT_FAILURE, "Invalid CPU list '%s', must be like '0-3,8'.", value);
+
+        digit = false;
     }
 
-    setbuf(fp, NULL);
+    if (!digit)
+        errx(EXIT_FAILURE, "Invalid CPU list '%s', must be like '0-3,8'.", value);
+
+    return value;
+}
+
+int get_numa_node(const char *const value)
+{
+    if (strcmp(value, "auto") == 0)
+        return NUMA_NODE_AUTO;
 
-    int exit_code = 1;
+    const uint64_t ret = str2uint(value);
 
-    LOG_D("Writing value %" PRIu64 " to '%s'.", value, file_path);
+    // str2uint() возвращает 0 и для ошибки, поэтому "0" проверяем отдельно.
+    if ((ret == 0 && strcmp(value, "0") != 0) || ret >= MAX_NUMA_NODES)
+        errx(EXIT_FAILURE, "Invalid NUMA node '%s', must be 'auto' or in [0..%d].", value, MAX_NUMA_NODES - 1);
 
-    if (fprintf(fp, "%" PRIu64 "\n", value) <= 0)
-        LOG_E("Unable to write value %" PRIu64 " to file '%s', error '%m'.", value, file_path);
-    else
-        exit_code = 0;
+    return ret;
+}
+
+unsigned int get_io_weight(const char *const value)
+{
+    const uint64_t ret = str2uint(value);
+
+    if (ret < MIN_IO_WEIGHT || ret > MAX_IO_WEIGHT)
+        errx(EXIT_FAILURE, "Invalid I/O weight value '%s', must be in [%u..%u].", value, MIN_IO_WEIGHT, MAX_IO_WEIGHT);
+
+    return ret;
+}
+
+/*
+ * \fn void get_io_device(const char *const name, unsigned int *out_major, unsigned int *out_minor)
+ * \brief Определяет номер блочного устройства по названию.
+ * \param const char *const name: Номер устройства ("8:0"), путь к нему ("/dev/sda") или название ("sda").
+ * \param unsigned int *out_major: Старший номер устройства.
+ * \param unsigned int *out_minor: Младший номер устройства.
+ * \warning Если устройство не найдено, функция завершает программу с кодом 1.
+ */
+static void get_io_device(const char *const name, unsigned int *out_major, unsigned int *out_minor)
+{
+    char path[MAX_FILE_PATH];
+    struct stat st;
+    int len = 0;
+
+    if (sscanf(name, "%u:%u%n", out_major, out_minor, &len) == 2 && name[len] == '\0')
+        return;
+
+    if (snprintf(path, sizeof(path), ((*name == '/') ? "%s" : "/dev/%s"), name) >= (int) sizeof(path))
+        errx(EXIT_FAILURE, "Too long block device name '%s'.", name);
+
+    if (stat(path, &st) == -1)
+        err(EXIT_FAILURE, "Unable to find block device '%s'", path);
+
+    if (!S_ISBLK(st.st_mode))
+        errx(EXIT_FAILURE, "File '%s' is not a block device.", path);
+
+    *out_major = major(st.st_rdev);
+    *out_minor = minor(st.st_rdev);
+
+    // Ядро принимает ограничения только для целых дисков, запись для раздела вернёт EINVAL.
+
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/partition", *out_major, *out_minor);
+
+    if (access(path, F_OK) == 0)
+        errx(EXIT_FAILURE, "Block device '%s' is a partition, I/O can be limited only for a whole disk.", name);
+}
+
+void get_io_max(char *value, cgroup_limits_t *limits)
+{
+    unsigned int major;
+    unsigned int minor;
+
+    // WARN: ':' есть и в номере устройства ("8:0"), поэтому устройство отделяем
+    // последним ':' перед первым '='.
+
+    char *const eq = strchr(value, '=');
+
+    if (eq == NULL)
+        errx(EXIT_FAILURE, "Invalid I/O limit '%s', must be like 'DEV:rbps=NUM,wiops=NUM'.", value);
+
+    *eq = '\0';
+    char *const sep = strrchr(value, ':');
+    *eq = '=';
+
+    if (sep == NULL || sep == value)
+        errx(EXIT_FAILURE, "Invalid I/O limit '%s', must be like 'DEV:rbps=NUM,wiops=NUM'.", value);
+
+    *sep = '\0';
+
+    get_io_device(value, &major, &minor);
+
+    // Повторно заданное устройство дополняет свои же ограничения.
 
-    if (fclose(fp) == EOF) {
-        LOG_C("Unable to close file '%s', error '%m'.", file_path);
+    io_device_limits_t *device = NULL;
+
+    for (unsigned int i = 0; i < limits->io_max_count && device == NULL; i++)
+        if (limits->io_max[i].major == major && limits->io_max[i].minor == minor)
+            device = &limits->io_max[i];
+
+    if (device == NULL) {
+        if (limits->io_max_count == MAX_IO_DEVICES)
+            errx(EXIT_FAILURE, "Too many I/O limited devices, at most %d are supported.", MAX_IO_DEVICES);
+
+        device = &limits->io_max[limits->io_max_count++];
+        memset(device, 0, sizeof(*device));
+        device->major = major;
+        device->minor = minor;
+    }
+
+    // WARN: В опциях cgctl запятая разделяет сами опции, поэтому разрешаем и ':'.
+
+    for (char *key = sep + 1, *next; key != NULL; key = next) {
+        if ((next = strpbrk(key, ",:")) != NULL)
+            *next++ = '\0';
+
+        char *const num = strchr(key, '=');
+        io_limit_t limit = IO_LIMITS_COUNT;
+
+        if (num != NULL) {
+            *num = '\0';
+
+            for (io_limit_t i = 0; i < IO_LIMITS_COUNT; i++)
+                if (strcmp(key, io_limit_names[i]) == 0)
+                    limit = i;
+        }
+
+        if (limit == IO_LIMITS_COUNT)
+            errx(EXIT_FAILURE, "Invalid I/O limit '%s' for device '%s', must be rbps, wbps, riops or wiops.", key, value);
+
+        // Скорость можно задавать с суффиксом K, M или G; "max" снимает ограничение.
+
+        if (strcmp(num + 1, "max") == 0)
+            device->max[limit] = 0;
+        else if ((device->max[limit] = str2size(num + 1)) == 0)
+            errx(EXIT_FAILURE, "Invalid I/O limit %s value '%s', must be a positive number or 'max'.", key, num + 1);
+    }
+}
+
+unsigned int get_max_tasks(const char *const value)
+{
+    const uint64_t ret = str2uint(value);
+
+    if (ret < 1 || ret > MAX_TASKS)
+        errx(EXIT_FAILURE, "Invalid max tasks value '%s', must be in [1..%u].", value, MAX_TASKS);
+
+    return ret;
+}
+
+unsigned int get_timeout(const char *const value)
+{
+    const uint64_t ret = str2uint(value);
+
+    if (ret < 1 || ret > MAX_TIMEOUT_MS)
+        errx(EXIT_FAILURE, "Invalid timeout value '%s', must be in [1..%u] ms.", value, MAX_TIMEOUT_MS);
+
+    return ret;
+}
+
+int get_signal(const char *const value)
+{
+    // clang-format off
+    static const struct {
+        const char *name;
+        int signal;
+    } signals[] = {
+        { "HUP", SIGHUP },
+        { "INT", SIGINT },
+        { "QUIT", SIGQUIT },
+        { "KILL", SIGKILL },
+        { "USR1", SIGUSR1 },
+        { "USR2", SIGUSR2 },
+        { "TERM", SIGTERM }
+    };
+    // clang-format on
+
+    const char *name = value;
+
+    if (strncmp(name, "SIG", 3) == 0)
+        name += 3;
+
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+        if (strcmp(name, signals[i].name) == 0)
+            return signals[i].signal;
+
+    const uint64_t ret = str2uint(value);
+
+    if (ret < 1 || ret >= NSIG)
+        errx(EXIT_FAILURE, "Invalid signal '%s'.", value);
+
+    return ret;
+}
+
+unsigned int get_jobs(const char *const value)
+{
+    const uint64_t ret = str2uint(value);
+
+    if (ret < 1 || ret > MAX_JOBS)
+        errx(EXIT_FAILURE, "Invalid jobs count '%s', must be in [1..%u].", value, MAX_JOBS);
+
+    return ret;
+}
+
+pid_t get_pid(const char *const value)
+{
+    const uint64_t ret = str2uint(value);
+
+    // Pid'ы не бывают больше PID_MAX_LIMIT, как и количество процессов.
+    if (ret < 1 || ret > MAX_TASKS)
+        errx(EXIT_FAILURE, "Invalid pid '%s', must be in [1..%u].", value, MAX_TASKS);
+
+    return ret;
+}
+
+uint64_t get_monotonic_us(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+        LOG_C("Unable to get monotonic time, error '%m'.");
+        abort();
+    }
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t page_align(const uint64_t value)
+{
+    const long page_size = sysconf(_SC_PAGESIZE);
+
+    if (page_size <= 0) {
+        LOG_C("Unable to get page size, error '%m'.");
+        abort();
+    }
+
+    return value - value % page_size;
+}
+
+ssize_t read_file(const char *const path, char *buf, const size_t size)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return -1;
+
+    const ssize_t len = read(fd, buf, size - 1);
+    const int saved_errno = errno;
+
+    if (close(fd) == -1) {
+        LOG_C("Unable to close file '%s', error '%m'.", path);
         abort();
     }
 
-    return exit_code;
+    if (len == -1) {
+        errno = saved_errno;
+        return -1;
+    }
+
+    buf[len] = '\0';
+
+    return len;
 }
 
 void get_group_name(const char *const file_path, char *group)
@@ -173,49 +550,17 @@ void get_group_name(const char *const file_path, char *group)
     }
 }
 
-void copy_raw_content(const char *const src_dir_path, const char *const dst_dir_path, const char *const file_name)
+void print_json_string(FILE *out, const char *const value)
 {
-    char src_file_path[MAX_FILE_PATH];
-    char dst_file_path[MAX_FILE_PATH];
+    fputc('"', out);
 
-    format_path(src_file_path, src_dir_path, file_name);
-
-    format_path(dst_file_path, dst_dir_path, file_name);
-
-    LOG_D("Copying file '%s' to '%s'.", src_file_path, dst_file_path);
-
-    const int in_fd = open(src_file_path, O_RDONLY | O_CLOEXEC);
-
-    if (in_fd == -1) {
-        LOG_C("Unable to open source file '%s': error '%m'.", src_file_path);
-        abort();
-    }
-
-    const int out_fd = open(dst_file_path, O_WRONLY | O_CLOEXEC);
-
-    // WARN: При ошибках дескрипторы не закрываем потому что всё равно собираемся падать!
-
-    if (out_fd == -1) {
-        LOG_C("Unable to open destination file '%s': error '%m'.", dst_file_path);
-        abort();
-    }
-
-    // Данных в файле гарантированно менее одного килобайта.
-
-    if (sendfile(out_fd, in_fd, NULL, 1024) == -1) {
-        LOG_C("Unable to copy content from file '%s' to '%s': error '%m'.", src_file_path, dst_file_path);
-        abort();
-    }
-
-    if (close(out_fd) == -1) {
-        LOG_C("Unable to close destination file '%s': error '%m'.", dst_file_path);
-        abort();
-    }
-
-    if (close(in_fd) == -1) {
-        LOG_C("Unable to close source file '%s': error '%m'.", src_file_path);
-        abort();
-    }
+    for (const unsigned char *p = (const unsigned char *) value; *p != '\0'; p++)
+        if (*p == '"' || *p == '\\')
+            fprintf(out, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(out, "\\u%04x", *p);
+        else
+            fputc(*p, out);
 
-    LOG_D("File '%s' has been copied successfully to '%s'.", src_file_path, dst_file_path);
+    fputc('"', out);
 }
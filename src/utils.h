@@ -2,6 +2,10 @@
 #define SRC_UTILS_H_
 
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "cgroup.h"
 
 // максимальная длина пути в /cgroup.
 #define MAX_FILE_PATH (256)
@@ -10,6 +14,31 @@
 // на самом деле 20, но округляем по степени 2.
 #define MAX_UINT64_STR_SIZE (32)
 
+// максимальное значение таймаутов, задаваемых в опциях, миллисекунд.
+#define MAX_TIMEOUT_MS (3600000u)
+
+// максимальное количество параллельно выполняемых заданий.
+#define MAX_JOBS (1024u)
+
+// максимальное количество узлов NUMA.
+#define MAX_NUMA_NODES (64)
+
+// узел NUMA не задан.
+#define NUMA_NODE_NONE (-1)
+
+// узел NUMA выбирается автоматически.
+#define NUMA_NODE_AUTO (-2)
+
+// допустимые значения веса ввода-вывода (шкала io.weight).
+#define MIN_IO_WEIGHT (1u)
+#define MAX_IO_WEIGHT (10000u)
+
+// вес ввода-вывода по-умолчанию (шкала io.weight).
+#define DEFAULT_IO_WEIGHT (100u)
+
+// максимальное количество процессов в cgroup, больше не бывает pid'ов (PID_MAX_LIMIT).
+#define MAX_TASKS (4194304u)
+
 /*
  * \fn uint64_t str2uint(const char *const value)
  * \brief Конвертирует строку в целое положительное число, игнорируя конец строки если он есть.
@@ -19,6 +48,15 @@
  */
 uint64_t str2uint(const char *const value);
 
+/*
+ * \fn uint64_t get_key_value(const char *const buf, const char *const key)
+ * \brief Ищет значение в содержимом файла из строк вида "ключ значение" (cpu.stat, memory.stat и т.п.).
+ * \param const char *const buf: Содержимое файла.
+ * \param const char *const key: Ключ.
+ * \return Значение; 0 если ключа нет.
+ */
+uint64_t get_key_value(const char *const buf, const char *const key);
+
 /*
  * \fn unsigned int get_cpu_usage(const char *const value)
  * \brief Конвертирует из строки и возвращает ограничение по CPU в процентах.
@@ -38,33 +76,141 @@ unsigned int get_cpu_usage(const char *const value);
 unsigned int get_mem_usage(const char *const value);
 
 /*
- * \fn void format_path(char *file_path, const char *const dir_path, const char *const entry_name)
- * \brief Объединяет два элемента пути к файлу или каталогу.
- * \param char *file_path: Указатель на массив, в который будет помещён результат объединения.
- * \param const char *const dir_path: Путь к каталогу.
- * \param const char *const entry_name: Название файла или каталога.
+ * \fn uint64_t get_mem_size(const char *const value)
+ * \brief Конвертирует из строки и возвращает объём памяти.
+ * \param const char *const value: Объём в процентах от оперативной памяти ("25%") или
+ *        в байтах с необязательным суффиксом K, M или G ("512M").
+ * \return Объём памяти, байт.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+uint64_t get_mem_size(const char *const value);
+
+/*
+ * \fn unsigned int get_cpu_quota(const char *const value)
+ * \brief Конвертирует из строки и возвращает жёсткое ограничение по CPU.
+ * \param const char *const value: Ограничение в процентах от всех ядер ("50%") или в ядрах ("1.5").
+ * \return Ограничение в тысячных долях ядра.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+unsigned int get_cpu_quota(const char *const value);
+
+/*
+ * \fn unsigned int get_cpu_period(const char *const value)
+ * \brief Конвертирует из строки и возвращает период планировщика CFS.
+ * \param const char *const value: Период в виде строки, микросекунд.
+ * \return Числовое значение периода, микросекунд.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+unsigned int get_cpu_period(const char *const value);
+
+/*
+ * \fn char *get_cpu_list(char *value)
+ * \brief Проверяет список CPU в формате cpuset ("0-3,8"), разделителем можно указывать и ':'.
+ * \param char *value: Список CPU в виде строки, ':' в нём заменяются на ','.
+ * \return Список CPU.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+char *get_cpu_list(char *value);
+
+/*
+ * \fn int get_numa_node(const char *const value)
+ * \brief Конвертирует из строки и возвращает номер узла NUMA.
+ * \param const char *const value: Номер узла или "auto".
+ * \return Номер узла; NUMA_NODE_AUTO для "auto".
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+int get_numa_node(const char *const value);
+
+/*
+ * \fn unsigned int get_io_weight(const char *const value)
+ * \brief Конвертирует из строки и возвращает вес ввода-вывода.
+ * \param const char *const value: Вес в виде строки, в шкале io.weight (100 - по-умолчанию).
+ * \return Числовое значение веса.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+unsigned int get_io_weight(const char *const value);
+
+/*
+ * \fn void get_io_max(char *value, cgroup_limits_t *limits)
+ * \brief Разбирает ограничения ввода-вывода устройства и добавляет их в limits.
+ * \param char *value: Ограничения в виде "DEV:rbps=NUM,wbps=NUM,riops=NUM,wiops=NUM", ключи можно
+ *        разделять и ':'. DEV - номер ("8:0"), путь ("/dev/sda") или название ("sda") устройства.
+ *        Строка портится при разборе.
+ * \param cgroup_limits_t *limits: Ограничения.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+void get_io_max(char *value, cgroup_limits_t *limits);
+
+/*
+ * \fn unsigned int get_max_tasks(const char *const value)
+ * \brief Конвертирует из строки и возвращает ограничение количества процессов.
+ * \param const char *const value: Ограничение в виде строки.
+ * \return Числовое значение ограничения.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+unsigned int get_max_tasks(const char *const value);
+
+/*
+ * \fn unsigned int get_timeout(const char *const value)
+ * \brief Конвертирует из строки и возвращает таймаут в миллисекундах.
+ * \param const char *const value: Таймаут в виде строки.
+ * \return Числовое значение таймаута, миллисекунд.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+unsigned int get_timeout(const char *const value);
+
+/*
+ * \fn int get_signal(const char *const value)
+ * \brief Конвертирует из строки и возвращает номер сигнала.
+ * \param const char *const value: Номер или название сигнала (TERM, SIGTERM, 15).
+ * \return Номер сигнала.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+int get_signal(const char *const value);
+
+/*
+ * \fn unsigned int get_jobs(const char *const value)
+ * \brief Конвертирует из строки и возвращает количество параллельно выполняемых заданий.
+ * \param const char *const value: Количество заданий в виде строки.
+ * \return Числовое значение количества заданий.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+unsigned int get_jobs(const char *const value);
+
+/*
+ * \fn pid_t get_pid(const char *const value)
+ * \brief Конвертирует из строки и возвращает pid процесса.
+ * \param const char *const value: Pid в виде строки.
+ * \return Pid процесса.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+pid_t get_pid(const char *const value);
+
+/*
+ * \fn uint64_t get_monotonic_us(void)
+ * \brief Возвращает текущее значение монотонных часов.
+ * \return Время, микросекунд.
  */
-void format_path(char *file_path, const char *const dir_path, const char *const entry_name);
+uint64_t get_monotonic_us(void);
 
 /*
- * \fn int read_num(uint64_t *out_value, const char *const dir_path, const char *const file_name)
- * \brief Читает целочисленное значение из файла в /cgroup/$group_name.
- * \param uint64_t *out_value: Указатель на переменную, в которую будет помещено прочитанное значение.
- * \param const char *const dir_path: Путь к каталогу /cgroup/$group_name.
- * \param const char *const file_name: Название файла.
- * \return 1 в случае ошибок; 0 если значение прочитано успешно.
+ * \fn uint64_t page_align(const uint64_t value)
+ * \brief Округляет размер вниз до целого числа страниц памяти.
+ * \param const uint64_t value: Размер, байт.
+ * \return Округлённый размер, байт.
+ * \note Ядро хранит ограничения памяти в страницах, поэтому читается обратно именно такое значение.
  */
-int read_num(uint64_t *out_value, const char *const dir_path, const char *const file_name);
+uint64_t page_align(const uint64_t value);
 
 /*
- * \fn int write_num(const uint64_t value, const char *const dir_path, const char *const file_name)
- * \brief Записывает целочисленное значение в файл в /cgroup.
- * \param const uint64_t value: Записываемое значение.
- * \param const char *const dir_path: Путь к каталогу /cgroup/$group_name.
- * \param const char *const file_name: Название файла.
- * \return 1 в случае ошибок; 0 если значение записано успешно.
+ * \fn ssize_t read_file(const char *const path, char *buf, const size_t size)
+ * \brief Читает небольшой файл (sysfs, procfs) целиком и завершает его содержимое '\0'.
+ * \param const char *const path: Путь к файлу.
+ * \param char *buf: Буфер.
+ * \param const size_t size: Размер буфера.
+ * \return Количество прочитанных байт; -1 в случае ошибки (errno сохраняется).
  */
-int write_num(const uint64_t value, const char *const dir_path, const char *const file_name);
+ssize_t read_file(const char *const path, char *buf, const size_t size);
 
 /*
  * \fn void get_group_name(const char *const file_path, char *group)
@@ -76,13 +222,11 @@ int write_num(const uint64_t value, const char *const dir_path, const char *cons
 void get_group_name(const char *const file_path, char *group);
 
 /*
- * \fn void copy_raw_content(const char *const src_dir_path, const char *const dst_dir_path, const char *const file_name)
- * \brief Копирует содержимое файла.
- * \param const char *const src_dir_path: Каталог с исходным файлом (откуда копируем).
- * \param const char *const dst_dir_path: Каталог с файлом назначения (куда копируем).
- * \param const char *const file_name: Название файла;
- * \warning В случае ошибок вызывает функцию abort().
+ * \fn void print_json_string(FILE *out, const char *const value)
+ * \brief Выводит строку в формате JSON.
+ * \param FILE *out: Куда выводить.
+ * \param const char *const value: Строка.
  */
-void copy_raw_content(const char *const src_dir_path, const char *const dst_dir_path, const char *const file_name);
+void print_json_string(FILE *out, const char *const value);
 
 #endif /* SRC_UTILS_H_ */
@@ -0,0 +1,116 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+#include "wait.h"
+
+// количество быстрых проверок условия без пауз (spin)
+#define SPIN_COUNT (16u)
+
+// начальная пауза между проверками, микросекунд
+#define MIN_DELAY_US (100u)
+
+// максимальная пауза между проверками, микросекунд
+#define MAX_DELAY_US (50000u)
+
+/*
+ * \fn void rearm_event(const int event_fd)
+ * \brief Перечитывает файл с уведомлениями, чтобы следующий poll(2) ждал нового события.
+ * \param const int event_fd: Дескриптор файла cgroup.
+ */
+static void rearm_event(const int event_fd)
+{
+    char buf[256];
+
+    // WARN: kernfs считает событие доставленным только после чтения файла,
+    // без этого poll(2) будет возвращаться сразу же.
+
+    if (pread(event_fd, buf, sizeof(buf), 0) == -1) {
+        LOG_C("Unable to read events file, error '%m'.");
+        abort();
+    }
+}
+
+/*
+ * \fn void wait_event(const int event_fd, const uint64_t delay_us)
+ * \brief Ждёт уведомления от cgroup или истечения паузы.
+ * \param const int event_fd: Дескриптор файла cgroup или -1.
+ * \param const uint64_t delay_us: Пауза, микросекунд.
+ */
+static void wait_event(const int event_fd, const uint64_t delay_us)
+{
+    if (event_fd == -1) {
+        usleep(delay_us);
+        return;
+    }
+
+    struct pollfd pfd = { .fd = event_fd, .events = POLLPRI };
+
+    // Пауза остаётся страховкой на случай потерянного уведомления.
+    const int timeout_ms = (delay_us + 999) / 1000;
+
+    if (poll(&pfd, 1, timeout_ms) == -1 && errno != EINTR) {
+        LOG_C("Unable to poll events file, error '%m'.");
+        abort();
+    }
+}
+
+int wait_for(wait_check_t check, void *arg, const int event_fd, const unsigned int timeout_ms)
+{
+    const uint64_t deadline_us = get_monotonic_us() + (uint64_t) timeout_ms * 1000;
+
+    if (event_fd != -1)
+        rearm_event(event_fd);
+
+    // Чаще всего ядро успевает сменить состояние за микросекунды, поэтому сначала
+    // просто несколько раз перепроверяем условие, уступая процессор.
+
+    for (size_t i = 0; i < SPIN_COUNT; i++) {
+        if (check(arg))
+            return 0;
+
+        sched_yield();
+    }
+
+    uint64_t delay_us = MIN_DELAY_US;
+
+    for (size_t attempt = 1;; attempt++) {
+        if (event_fd != -1)
+            rearm_event(event_fd);
+
+        if (check(arg)) {
+            LOG_D("Condition satisfied after %zu attempts.", attempt);
+            return 0;
+        }
+
+        const uint64_t now_us = get_monotonic_us();
+
+        if (now_us >= deadline_us)
+            break;
+
+        if (delay_us > deadline_us - now_us)
+            delay_us = deadline_us - now_us;
+
+        wait_event(event_fd, delay_us);
+
+        delay_us *= 2;
+
+        if (delay_us > MAX_DELAY_US)
+            delay_us = MAX_DELAY_US;
+    }
+
+    // Таймаут - обычный исход для раундов прибивания и мягкой остановки,
+    // о настоящих ошибках вызывающие сообщают сами.
+    LOG_D("Condition has not been satisfied in %u ms.", timeout_ms);
+
+    return 1;
+}
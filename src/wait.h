@@ -0,0 +1,26 @@
+#ifndef SRC_WAIT_H_
+#define SRC_WAIT_H_
+
+#include <stdbool.h>
+
+/*
+ * \brief Функция проверки условия, которого дожидается wait_for().
+ * \param void *arg: Произвольный аргумент, переданный в wait_for().
+ * \return true - если условие выполнено и ждать больше не нужно; false - если нет.
+ */
+typedef bool (*wait_check_t)(void *arg);
+
+/*
+ * \fn int wait_for(wait_check_t check, void *arg, const int event_fd, const unsigned int timeout_ms)
+ * \brief Дожидается выполнения условия: сначала короткий spin, затем паузы с экспоненциальным ростом.
+ * \param wait_check_t check: Функция проверки условия.
+ * \param void *arg: Аргумент функции проверки.
+ * \param const int event_fd: Дескриптор файла cgroup, поддерживающего уведомления через poll(2)
+ *        (например cgroup.events), или -1 если уведомлений нет.
+ * \param const unsigned int timeout_ms: Общий таймаут ожидания, миллисекунд.
+ * \return 1 если условие не выполнилось за отведённое время; 0 если всё хорошо.
+ * \note Истечение таймаута ошибкой не логируется, это решает вызывающий.
+ */
+int wait_for(wait_check_t check, void *arg, const int event_fd, const unsigned int timeout_ms);
+
+#endif /* SRC_WAIT_H_ */
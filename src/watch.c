@@ -0,0 +1,589 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "conf.h"
+#include "group.h"
+#include "log.h"
+#include "utils.h"
+
+#define PROG_NAME ("cgctl-watch")
+
+// максимальное количество порогов потребления памяти
+#define MAX_THRESHOLDS (8u)
+
+// максимальное количество триггеров PSI
+#define MAX_TRIGGERS (8u)
+
+// максимальное количество подписок: OOM и пороги на v1 или memory.events на v2, и триггеры PSI
+#define MAX_WATCHES (MAX_THRESHOLDS + MAX_TRIGGERS + 1)
+
+// допустимое ядром окно триггера PSI, миллисекунд
+#define MIN_PSI_WINDOW_MS (500u)
+#define MAX_PSI_WINDOW_MS (10000u)
+
+// кратность окна триггера PSI для процессов без CAP_SYS_RESOURCE, миллисекунд
+#define PSI_UNPRIV_WINDOW_MS (2000u)
+
+// как часто проверяем, что cgroup ещё существует, миллисекунд
+#define ALIVE_CHECK_MS (1000)
+
+// счётчики memory.events, о росте которых сообщаем
+static const char *const events_keys[] = { "high", "max", "oom", "oom_kill" };
+
+#define EVENTS_KEYS_COUNT (sizeof(events_keys) / sizeof(events_keys[0]))
+
+typedef enum
+{
+    WATCH_OOM = 0, // memory.oom_control через eventfd (v1)
+    WATCH_THRESHOLD, // порог memory.usage_in_bytes через eventfd (v1)
+    WATCH_EVENTS, // memory.events через poll (v2)
+    WATCH_PRESSURE // триггер PSI в cpu.pressure, memory.pressure или io.pressure через poll
+} watch_kind_t;
+
+// подписка на события памяти cgroup
+typedef struct
+{
+    watch_kind_t kind; // тип подписки
+    int fd; // дескриптор, который ждём в epoll: eventfd (v1) или memory.events (v2)
+    int file_fd; // файл, к которому привязан eventfd (v1), из него же читаем подробности
+    uint64_t threshold; // порог, байт (только WATCH_THRESHOLD)
+    uint64_t counters[EVENTS_KEYS_COUNT]; // последние значения memory.events (только WATCH_EVENTS)
+    const char *resource; // ресурс триггера PSI: cpu, memory или io (только WATCH_PRESSURE)
+    bool full; // триггер на простой всех задач (full), а не хотя бы одной (some)
+    unsigned int stall_us; // суммарный простой в окне, при котором срабатывает триггер, микросекунд
+    unsigned int window_us; // окно триггера, микросекунд
+} watch_t;
+
+// что делать при событии
+typedef struct
+{
+    const char *group; // название cgroup
+    const char *command; // команда для SHELL или NULL
+    int signal; // сигнал для процесса pid
+    pid_t pid; // процесс, которому отправляется сигнал, или 0
+} hook_t;
+
+static void show_usage(void)
+{
+    // clang-format off
+    const char *const usage =
+        "Usage: %s [-h|--help] [-d|--debug] [-T|--threshold=SIZE] [-P|--pressure=TRIGGER] [-e|--exec=CMD] [-s|--signal=SIG] [-p|--pid=PID] GROUP\n"
+        "\t-h|--help: show this help;\n"
+        "\t-d|--debug: enable debug mode;\n"
+        "\t-T|--threshold=SIZE: report when memory usage crosses SIZE, NUM%% of RAM or bytes with K/M/G suffix, may be repeated (v1 only);\n"
+        "\t-P|--pressure=TRIGGER: report when tasks stall on a resource, RESOURCE:some|full:STALL_MS:WINDOW_MS, e.g. memory:some:150:1000, may be repeated;\n"
+        "\t-e|--exec=CMD: run CMD with CGCTL_GROUP, CGCTL_EVENT and CGCTL_VALUE in the environment on every event;\n"
+        "\t-s|--signal=SIG: send SIG to PID on every event, only together with --pid (USR1 by default);\n"
+        "\t-p|--pid=PID: process to send the signal to (no signal by default);\n"
+        "\tGROUP: group name;\n"
+    ;
+    // clang-format on
+
+    fprintf(stdout, usage, PROG_NAME);
+}
+
+/*
+ * \fn void run_hook(const hook_t *const hook, const char *const event, const uint64_t value)
+ * \brief Отправляет сигнал и запускает команду, не дожидаясь её завершения.
+ * \param const hook_t *const hook: Что делать при событии.
+ * \param const char *const event: Название события (oom, oom_kill, threshold, high, max).
+ * \param const uint64_t value: Значение, связанное с событием.
+ */
+static void run_hook(const hook_t *const hook, const char *const event, const uint64_t value)
+{
+    // Сигнал быстрее запуска команды, поэтому отправляем его первым.
+    if (hook->pid != 0 && kill(hook->pid, hook->signal) == -1)
+        LOG_E("Unable to send signal %d to process %d, error '%m'.", hook->signal, hook->pid);
+
+    if (hook->command == NULL)
+        return;
+
+    log_flush(); // WARN: Иначе буфер лога продублирует дочерний процесс.
+
+    const pid_t pid = fork();
+
+    if (pid == -1) {
+        LOG_E("Unable to run hook for event '%s', error '%m'.", event);
+        return;
+    }
+
+    if (pid != 0)
+        return; // Завершившиеся команды подбирает ядро: SIGCHLD игнорируется.
+
+    char value_str[MAX_UINT64_STR_SIZE];
+
+    snprintf(value_str, sizeof(value_str), "%" PRIu64, value);
+
+    if (setenv("CGCTL_GROUP", hook->group, 1) == -1 || setenv("CGCTL_EVENT", event, 1) == -1
+        || setenv("CGCTL_VALUE", value_str, 1) == -1)
+        _exit(EXIT_FAILURE);
+
+    // Потомок не должен унаследовать игнорирование SIGCHLD.
+    signal(SIGCHLD, SIG_DFL);
+
+    execl(SHELL, SHELL, "-c", hook->command, (char *) NULL);
+
+    LOG_E("Unable to run hook '%s', error '%m'.", hook->command);
+    _exit(EXIT_FAILURE);
+}
+
+/*
+ * \fn int register_event(const group_dir_t *const dir, watch_t *watch, const char *const file_name)
+ * \brief Подписывается через cgroup.event_control на уведомления о файле memory cgroup v1.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param watch_t *watch: Подписка, заполняются fd и file_fd.
+ * \param const char *const file_name: Файл memory.oom_control или memory.usage_in_bytes.
+ * \return 1 в случае ошибки; 0 если подписка создана.
+ */
+static int register_event(const group_dir_t *const dir, watch_t *watch, const char *const file_name)
+{
+    // WARN: cgroup.event_control лежит в той же иерархии, что и файл, на который подписываемся,
+    // а не в основной, поэтому открываем его относительно каталога иерархии memory.
+    const int memory_fd = group_fd(dir, file_name);
+
+    if (memory_fd == -1) {
+        fprintf(stderr, "Error: Memory controller is not mounted.\n");
+        return 1;
+    }
+
+    if ((watch->file_fd = open_file(dir, file_name, O_RDONLY)) == -1) {
+        fprintf(stderr, "Error: Unable to open file '%s' of group '%s': %m.\n", file_name, dir->name);
+        return 1;
+    }
+
+    if ((watch->fd = eventfd(0, EFD_CLOEXEC)) == -1) {
+        fprintf(stderr, "Error: Unable to create eventfd: %m.\n");
+        return 1;
+    }
+
+    char buf[64];
+    int len;
+
+    if (watch->kind == WATCH_THRESHOLD)
+        len = snprintf(buf, sizeof(buf), "%d %d %" PRIu64, watch->fd, watch->file_fd, watch->threshold);
+    else
+        len = snprintf(buf, sizeof(buf), "%d %d", watch->fd, watch->file_fd);
+
+    const int control_fd = openat(memory_fd, "cgroup.event_control", O_WRONLY | O_CLOEXEC);
+
+    if (control_fd == -1 || write(control_fd, buf, len) != len) {
+        fprintf(stderr, "Error: Unable to subscribe to '%s' of group '%s': %m.\n", file_name, dir->name);
+
+        if (control_fd != -1)
+            close(control_fd);
+
+        return 1;
+    }
+
+    // После регистрации файл управления больше не нужен, подписка живёт, пока открыт eventfd.
+    close(control_fd);
+
+    return 0;
+}
+
+/*
+ * \fn void parse_trigger(char *value, watch_t *watch)
+ * \brief Разбирает триггер PSI вида RESOURCE:some|full:STALL_MS:WINDOW_MS.
+ * \param char *value: Триггер в виде строки, портится при разборе.
+ * \param watch_t *watch: Подписка, заполняются поля триггера.
+ * \warning Если значение некорректно, функция завершает программу с кодом 1.
+ */
+static void parse_trigger(char *value, watch_t *watch)
+{
+    static const char *const resources[] = { "cpu", "memory", "io" };
+
+    char *save = NULL;
+    const char *const resource = strtok_r(value, ":", &save);
+    const char *const type = strtok_r(NULL, ":", &save);
+    const char *const stall = strtok_r(NULL, ":", &save);
+    const char *const window = strtok_r(NULL, ":", &save);
+
+    if (window == NULL || strtok_r(NULL, ":", &save) != NULL)
+        errx(EXIT_FAILURE, "Invalid pressure trigger, must be RESOURCE:some|full:STALL_MS:WINDOW_MS.");
+
+    watch->kind = WATCH_PRESSURE;
+    watch->resource = NULL;
+
+    // Указатель на строку из таблицы, а не из value, чтобы он жил всё время работы.
+    for (size_t i = 0; i < sizeof(resources) / sizeof(resources[0]); i++)
+        if (strcmp(resource, resources[i]) == 0)
+            watch->resource = resources[i];
+
+    if (watch->resource == NULL)
+        errx(EXIT_FAILURE, "Invalid pressure resource '%s', must be cpu, memory or io.", resource);
+
+    if (strcmp(type, "some") != 0 && strcmp(type, "full") != 0)
+        errx(EXIT_FAILURE, "Invalid pressure type '%s', must be some or full.", type);
+
+    watch->full = (strcmp(type, "full") == 0);
+
+    const uint64_t window_ms = str2uint(window);
+
+    if (window_ms < MIN_PSI_WINDOW_MS || window_ms > MAX_PSI_WINDOW_MS)
+        errx(EXIT_FAILURE, "Invalid pressure window '%s', must be in [%u..%u] ms.", window, MIN_PSI_WINDOW_MS,
+             MAX_PSI_WINDOW_MS);
+
+    const uint64_t stall_ms = str2uint(stall);
+
+    if (stall_ms < 1 || stall_ms > window_ms)
+        errx(EXIT_FAILURE, "Invalid pressure stall '%s', must be in [1..%" PRIu64 "] ms.", stall, window_ms);
+
+    watch->stall_us = stall_ms * 1000;
+    watch->window_us = window_ms * 1000;
+}
+
+/*
+ * \fn int register_trigger(const group_dir_t *const dir, watch_t *watch)
+ * \brief Создаёт триггер PSI в файле давления ресурса cgroup.
+ * \param const group_dir_t *const dir: Каталог cgroup.
+ * \param watch_t *watch: Подписка, заполняются fd и file_fd.
+ * \return 1 в случае ошибки; 0 если триггер создан.
+ * \note Триггер живёт, пока открыт файл, поэтому на каждый триггер свой дескриптор.
+ */
+static int register_trigger(const group_dir_t *const dir, watch_t *watch)
+{
+    char file_name[32];
+    char trigger[64];
+
+    snprintf(file_name, sizeof(file_name), "%s.pressure", watch->resource);
+
+    const int len = snprintf(trigger, sizeof(trigger), "%s %u %u", (watch->full ? "full" : "some"), watch->stall_us,
+                             watch->window_us);
+
+    if ((watch->fd = open_file(dir, file_name, O_RDWR | O_NONBLOCK)) == -1) {
+        fprintf(stderr, "Error: Unable to open file '%s' of group '%s': %m.\n", file_name, dir->name);
+        return 1;
+    }
+
+    // WARN: Ядро ожидает триггер вместе с завершающим '\0'.
+    if (write(watch->fd, trigger, len + 1) != len + 1) {
+        fprintf(stderr, "Error: Unable to set trigger '%s' in '%s' of group '%s': %m.\n", trigger, file_name, dir->name);
+
+        // Без CAP_SYS_RESOURCE ядро принимает только окна, кратные PSI_UNPRIV_WINDOW_MS.
+        if (errno == EINVAL && watch->window_us % (PSI_UNPRIV_WINDOW_MS * 1000) != 0)
+            fprintf(stderr, "Note: Without CAP_SYS_RESOURCE the window must be a multiple of %u ms.\n", PSI_UNPRIV_WINDOW_MS);
+
+        return 1;
+    }
+
+    watch->file_fd = watch->fd;
+
+    return 0;
+}
+
+/*
+ * \fn int read_events(watch_t *watch, uint64_t *counters)
+ * \brief Читает счётчики memory.events cgroup v2.
+ * \param watch_t *watch: Подписка.
+ * \param uint64_t *counters: Счётчики в порядке events_keys.
+ * \return 1 если cgroup больше нет; 0 если счётчики прочитаны.
+ */
+static int read_events(watch_t *watch, uint64_t *counters)
+{
+    char buf[256];
+
+    // WARN: Чтение заодно сбрасывает уведомление kernfs, иначе epoll будет возвращаться сразу же.
+    const ssize_t len = pread(watch->fd, buf, sizeof(buf) - 1, 0);
+
+    if (len == -1)
+        return 1;
+
+    buf[len] = '\0';
+
+    for (size_t i = 0; i < EVENTS_KEYS_COUNT; i++)
+        counters[i] = get_key_value(buf, events_keys[i]);
+
+    return 0;
+}
+
+/*
+ * \fn int handle_event(watch_t *watch, const hook_t *const hook)
+ * \brief Разбирает сработавшую подписку и запускает действия.
+ * \param watch_t *watch: Подписка.
+ * \param const hook_t *const hook: Что делать при событии.
+ * \return 1 если cgroup больше нет; 0 если всё хорошо.
+ */
+static int handle_event(watch_t *watch, const hook_t *const hook)
+{
+    char buf[256];
+    uint64_t count;
+
+    if (watch->kind == WATCH_PRESSURE) {
+        const ssize_t len = pread(watch->fd, buf, sizeof(buf) - 1, 0);
+
+        // Триггер удалённой cgroup срабатывает с EPOLLERR, а чтение возвращает ENODEV.
+        if (len == -1)
+            return 1;
+
+        buf[len] = '\0';
+
+        // Строки файла: "some avg10=0.00 avg60=0.00 avg300=0.00 total=0" и такая же "full ...".
+        const char *const line = strstr(buf, (watch->full ? "full " : "some "));
+        double avg10 = 0;
+        uint64_t total_us = 0;
+
+        if (line != NULL)
+            sscanf(line + 5, "avg10=%lf avg60=%*f avg300=%*f total=%" SCNu64, &avg10, &total_us);
+
+        char event[32];
+
+        snprintf(event, sizeof(event), "%s_pressure", watch->resource);
+
+        // Запись в виде key=value, чтобы её было легко разобрать в системе сбора логов.
+        LOG_I("event=%s group=%s type=%s stall_us=%u window_us=%u avg10=%.2f total_us=%" PRIu64, event, hook->group,
+              (watch->full ? "full" : "some"), watch->stall_us, watch->window_us, avg10, total_us);
+        run_hook(hook, event, total_us);
+
+        return 0;
+    }
+
+    if (watch->kind == WATCH_EVENTS) {
+        uint64_t counters[EVENTS_KEYS_COUNT];
+
+        if (read_events(watch, counters) != 0)
+            return 1;
+
+        for (size_t i = 0; i < EVENTS_KEYS_COUNT; i++) {
+            if (counters[i] <= watch->counters[i])
+                continue;
+
+            LOG_I("Group '%s' got memory event '%s', %" PRIu64 " so far.", hook->group, events_keys[i], counters[i]);
+            run_hook(hook, events_keys[i], counters[i]);
+        }
+
+        memcpy(watch->counters, counters, sizeof(counters));
+
+        return 0;
+    }
+
+    // eventfd срабатывает и при удалении cgroup: тогда её файлы больше не читаются.
+    if (read(watch->fd, &count, sizeof(count)) != sizeof(count))
+        return 1;
+
+    const ssize_t len = pread(watch->file_fd, buf, sizeof(buf) - 1, 0);
+
+    if (len == -1)
+        return 1;
+
+    buf[len] = '\0';
+
+    if (watch->kind == WATCH_OOM) {
+        // Счётчик oom_kill есть в memory.oom_control только начиная с 4.13.
+        const uint64_t killed = get_key_value(buf, "oom_kill");
+
+        LOG_E("Group '%s' is out of memory, %" PRIu64 " tasks killed so far.", hook->group, killed);
+        run_hook(hook, "oom", killed);
+    } else {
+        const uint64_t usage = str2uint(buf);
+
+        LOG_I("Group '%s' memory usage %" PRIu64 " is %s threshold %" PRIu64 ".", hook->group, usage,
+              ((usage >= watch->threshold) ? "above" : "below"), watch->threshold);
+        run_hook(hook, "threshold", usage);
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+    bool debug = false;
+    bool signal_given = false;
+    uint64_t thresholds[MAX_THRESHOLDS];
+    size_t thresholds_count = 0;
+    watch_t triggers[MAX_TRIGGERS];
+    size_t triggers_count = 0;
+    hook_t hook = { .group = NULL, .command = NULL, .signal = SIGUSR1, .pid = 0 };
+
+    static struct option long_opts[] = {
+        { "help", no_argument, 0, 'h' },
+        { "debug", no_argument, 0, 'd' },
+        { "threshold", required_argument, 0, 'T' },
+        { "pressure", required_argument, 0, 'P' },
+        { "exec", required_argument, 0, 'e' },
+        { "signal", required_argument, 0, 's' },
+        { "pid", required_argument, 0, 'p' },
+        { 0, 0, 0, 0 }
+    };
+
+    while ((opt = getopt_long(argc, argv, "hdT:P:e:s:p:", long_opts, 0)) != -1)
+        switch (opt) {
+            case 'h':
+                show_usage();
+                return EXIT_FAILURE;
+
+            case 'd':
+                debug = true;
+                break;
+
+            case 'T':
+                if (thresholds_count == MAX_THRESHOLDS) {
+                    fprintf(stderr, "Error: Too many thresholds, at most %u are supported.\n", MAX_THRESHOLDS);
+                    return EXIT_FAILURE;
+                }
+                thresholds[thresholds_count++] = get_mem_size(optarg);
+                break;
+
+            case 'P':
+                if (triggers_count == MAX_TRIGGERS) {
+                    fprintf(stderr, "Error: Too many pressure triggers, at most %u are supported.\n", MAX_TRIGGERS);
+                    return EXIT_FAILURE;
+                }
+                parse_trigger(optarg, &triggers[triggers_count++]);
+                break;
+
+            case 'e':
+                if (*optarg == '\0') {
+                    fprintf(stderr, "Error: Command is empty.\n");
+                    return EXIT_FAILURE;
+                }
+                hook.command = optarg;
+                break;
+
+            case 's':
+                hook.signal = get_signal(optarg);
+                signal_given = true;
+                break;
+
+            case 'p':
+                hook.pid = get_pid(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Error: Unknown argument '%c'.\n", opt);
+                return EXIT_FAILURE;
+        }
+
+    if (argc - optind != 1 || *argv[optind] == '\0') {
+        fprintf(stderr, "Error: Exactly one group name must be given.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (signal_given && hook.pid == 0) {
+        fprintf(stderr, "Error: Signal is given without a process to send it to, use --pid.\n");
+        return EXIT_FAILURE;
+    }
+
+    hook.group = argv[optind];
+
+    log_open(PROG_NAME, debug);
+
+    // Команды запускаются асинхронно, зомби подбирает ядро.
+    signal(SIGCHLD, SIG_IGN);
+
+    group_dir_t dir;
+
+    if (group_open(&dir, get_root_dir(), hook.group) != 0) {
+        fprintf(stderr, "Error: Unable to open group '%s': %m.\n", hook.group);
+        return EXIT_FAILURE;
+    }
+
+    watch_t watches[MAX_WATCHES];
+    size_t count = 0;
+
+    if (get_backend()->version == 2) {
+        // На v2 порогов нет, их роль играет memory.high: о его превышении сообщает memory.events.
+        if (thresholds_count != 0) {
+            fprintf(stderr, "Error: Thresholds are not supported on cgroup v2, use memory.high (--mem-high) instead.\n");
+            return EXIT_FAILURE;
+        }
+
+        watch_t *const watch = &watches[count++];
+
+        watch->kind = WATCH_EVENTS;
+        watch->file_fd = -1;
+
+        if ((watch->fd = open_file(&dir, "memory.events", O_RDONLY)) == -1 || read_events(watch, watch->counters) != 0) {
+            fprintf(stderr, "Error: Unable to read memory events of group '%s': %m.\n", hook.group);
+            return EXIT_FAILURE;
+        }
+    } else {
+        watches[count].kind = WATCH_OOM;
+
+        if (register_event(&dir, &watches[count++], "memory.oom_control") != 0)
+            return EXIT_FAILURE;
+
+        for (size_t i = 0; i < thresholds_count; i++) {
+            watches[count].kind = WATCH_THRESHOLD;
+            watches[count].threshold = thresholds[i];
+
+            if (register_event(&dir, &watches[count++], "memory.usage_in_bytes") != 0)
+                return EXIT_FAILURE;
+        }
+    }
+
+    for (size_t i = 0; i < triggers_count; i++) {
+        watches[count] = triggers[i];
+
+        if (register_trigger(&dir, &watches[count++]) != 0)
+            return EXIT_FAILURE;
+    }
+
+    const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epoll_fd == -1) {
+        LOG_C("Unable to create epoll, error '%m'.");
+        abort();
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        // kernfs и PSI сообщают о событии через EPOLLPRI, eventfd - через EPOLLIN.
+        const bool is_eventfd = (watches[i].kind == WATCH_OOM || watches[i].kind == WATCH_THRESHOLD);
+
+        struct epoll_event event = { .events = (is_eventfd ? EPOLLIN : EPOLLPRI),
+                                     .data.ptr = &watches[i] };
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, watches[i].fd, &event) == -1) {
+            LOG_C("Unable to add descriptor to epoll, error '%m'.");
+            abort();
+        }
+    }
+
+    LOG_I("Watching memory and %zu pressure triggers of group '%s'.", triggers_count, hook.group);
+
+    for (bool alive = true; alive;) {
+        struct epoll_event events[MAX_WATCHES];
+
+        const int ready = epoll_wait(epoll_fd, events, MAX_WATCHES, ALIVE_CHECK_MS);
+
+        if (ready == -1 && errno != EINTR) {
+            LOG_C("Unable to wait for events, error '%m'.");
+            abort();
+        }
+
+        // Без событий раз в ALIVE_CHECK_MS проверяем, не удалили ли cgroup. Открытые файлы удалённой
+        // cgroup остаются открытыми, а вот найти в её каталоге ничего уже нельзя.
+        if (ready <= 0) {
+            alive = group_has_file(&dir, "memory.stat");
+            continue;
+        }
+
+        for (int i = 0; i < ready && alive; i++)
+            alive = (handle_event(events[i].data.ptr, &hook) == 0);
+
+        // Каждое пробуждение - отдельная операция: лимит одинаковых записей лога действует в её пределах.
+        log_flush();
+    }
+
+    LOG_I("Group '%s' has been removed, exiting.", hook.group);
+
+    // Дескрипторы подписок закроются при выходе, на v1 вместе с ними снимутся и подписки.
+    log_close();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+// This is a personal academic project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+#include "workers.h"
+
+/*
+ * \fn void start_job(worker_func_t func, worker_job_t *job)
+ * \brief Запускает задание в отдельном процессе.
+ * \param worker_func_t func: Функция задания.
+ * \param worker_job_t *job: Задание.
+ */
+static void start_job(worker_func_t func, worker_job_t *job)
+{
+    // WARN: Сбрасываем буферы stdio и лога, иначе их содержимое продублирует дочерний процесс.
+    fflush(stdout);
+    fflush(stderr);
+    log_flush();
+
+    job->started_us = get_monotonic_us();
+
+    const pid_t pid = fork();
+
+    if (pid == -1) {
+        LOG_C("Unable to fork() process, error '%m'.");
+        abort();
+    }
+
+    if (pid == 0) {
+        const int exit_code = func(job->name);
+
+        log_flush(); // _exit(2) не вызывает обработчики atexit(3)
+        _exit(exit_code);
+    }
+
+    LOG_D("Started worker %u for group '%s'.", pid, job->name);
+
+    job->pid = pid;
+}
+
+/*
+ * \fn worker_job_t *wait_job(worker_job_t *jobs, const size_t count)
+ * \brief Дожидается завершения любого из запущенных заданий и сохраняет его результат.
+ * \param worker_job_t *jobs: Задания.
+ * \param const size_t count: Количество заданий.
+ * \return Завершившееся задание.
+ */
+static worker_job_t *wait_job(worker_job_t *jobs, const size_t count)
+{
+    for (;;) {
+        int status;
+
+        const pid_t pid = waitpid(-1, &status, 0);
+
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+
+            LOG_C("Unable to wait for workers, error '%m'.");
+            abort();
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            worker_job_t *const job = &jobs[i];
+
+            if (job->pid != pid)
+                continue;
+
+            job->pid = 0;
+            job->elapsed_us = get_monotonic_us() - job->started_us;
+            job->status = ((WIFEXITED(status)) ? WEXITSTATUS(status) : -1);
+
+            if (job->status == -1)
+                LOG_E("Worker %u for group '%s' crashed.", pid, job->name);
+            else
+                LOG_D("Worker %u for group '%s' exited with code %d.", pid, job->name, job->status);
+
+            return job;
+        }
+
+        LOG_D("Reaped unknown child process %u.", pid);
+    }
+}
+
+size_t run_workers(worker_func_t func, worker_job_t *jobs, const size_t count, const unsigned int max_workers)
+{
+    size_t failed = 0;
+    size_t next = 0; // следующее незапущенное задание
+    size_t running = 0;
+
+    assert(max_workers > 0);
+
+    for (size_t i = 0; i < count; i++) {
+        jobs[i].pid = 0;
+        jobs[i].status = -1;
+        jobs[i].elapsed_us = 0;
+    }
+
+    while (next < count || running != 0) {
+        if (next < count && running < max_workers) {
+            start_job(func, &jobs[next++]);
+            running++;
+            continue;
+        }
+
+        const worker_job_t *const job = wait_job(jobs, count);
+
+        running--;
+
+        if (job->status != 0)
+            failed++;
+    }
+
+    return failed;
+}
@@ -0,0 +1,37 @@
+#ifndef SRC_WORKERS_H_
+#define SRC_WORKERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * \brief Задание, выполняемое в отдельном процессе.
+ * \param const char *const name: Название cgroup, для которой выполняется задание.
+ * \return Код выхода процесса-исполнителя.
+ */
+typedef int (*worker_func_t)(const char *const name);
+
+typedef struct
+{
+    const char *name; // название cgroup
+    pid_t pid; // pid процесса-исполнителя или 0 если задание ещё не запущено/уже завершено
+    int status; // код выхода задания; -1 если исполнитель упал
+    uint64_t started_us; // время запуска задания, микросекунд
+    uint64_t elapsed_us; // длительность задания, микросекунд
+} worker_job_t;
+
+/*
+ * \fn size_t run_workers(worker_func_t func, worker_job_t *jobs, const size_t count, const unsigned int max_workers)
+ * \brief Выполняет задания параллельно, каждое в отдельном процессе, не более max_workers одновременно.
+ * \param worker_func_t func: Функция задания.
+ * \param worker_job_t *jobs: Задания; в них же сохраняются результаты.
+ * \param const size_t count: Количество заданий.
+ * \param const unsigned int max_workers: Максимальное количество одновременно работающих процессов.
+ * \return Количество неуспешно завершившихся заданий.
+ * \note Отдельные процессы нужны потому что при критических ошибках код вызывает abort(),
+ *       и упасть должно только одно задание, а не все сразу.
+ */
+size_t run_workers(worker_func_t func, worker_job_t *jobs, const size_t count, const unsigned int max_workers);
+
+#endif /* SRC_WORKERS_H_ */